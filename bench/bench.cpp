@@ -0,0 +1,802 @@
+#include "slip.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+// Every allocation is counted, and its size is stored in front of it so that
+// frees can be accounted for too.
+std::atomic<size_t> g_allocs(0);
+std::atomic<size_t> g_live_bytes(0);
+
+void* operator new(size_t size) {
+    ++g_allocs;
+    g_live_bytes += size;
+    auto p = static_cast<size_t*>(std::malloc(size + sizeof(max_align_t)));
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    *p = size;
+    return reinterpret_cast<char*>(p) + sizeof(max_align_t);
+}
+
+// GCC can't tell that the pointer comes from the malloc above.
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* ptr) noexcept {
+    if (!ptr) {
+        return;
+    }
+    auto p = reinterpret_cast<size_t*>(static_cast<char*>(ptr) -
+                                       sizeof(max_align_t));
+    g_live_bytes -= *p;
+    std::free(p);
+}
+
+void operator delete(void* ptr, size_t) noexcept { operator delete(ptr); }
+
+// Runs f until at least min_secs elapsed and returns the mean seconds per run.
+double Time(const std::function<void()>& f, double min_secs = 0.3) {
+    using clock = std::chrono::steady_clock;
+    f();
+    size_t runs = 0;
+    auto start = clock::now();
+    std::chrono::duration<double> elapsed;
+    do {
+        f();
+        ++runs;
+        elapsed = clock::now() - start;
+    } while (elapsed.count() < min_secs);
+    return elapsed.count() / runs;
+}
+
+void Report(const std::string& name, double secs, size_t bytes) {
+    std::cout << std::left << std::setw(40) << name << std::right
+              << std::setw(10) << std::fixed << std::setprecision(2)
+              << bytes / secs / (1 << 20) << " MB/s\n";
+}
+
+// A flat script with many arguments of every kind.
+std::string WideScript(int n) {
+    std::string s = "(list";
+    for (int i = 0; i < n; ++i) {
+        s += " (+ " + std::to_string(i * 7919) + " \"payload " +
+             std::to_string(i) + "\") some_atom true";
+    }
+    return s + ")";
+}
+
+// (f (f (f ... 1))) nested depth times.
+std::string NestedScript(int depth) {
+    std::string s;
+    for (int i = 0; i < depth; ++i) {
+        s += "(f ";
+    }
+    s += "1";
+    for (int i = 0; i < depth; ++i) {
+        s += ")";
+    }
+    return s;
+}
+
+// Few tokens, each of them long: what the vectorized scanners are for.
+std::string LongTokensScript(int n) {
+    std::string s = "(list";
+    for (int i = 0; i < n; ++i) {
+        s += "    \"" + std::string(200, 'x') + "\" " +
+             std::string(60, 'a') + " 1234567890";
+    }
+    return s + ")";
+}
+
+// A balanced tree of arithmetic, 2^depth leaves.
+std::string ArithScript(int depth) {
+    if (depth == 0) {
+        return "1";
+    }
+    std::string sub = ArithScript(depth - 1);
+    return std::string(depth % 2 ? "(+ " : "(* ") + sub + " " + sub + ")";
+}
+
+size_t CountNodes(const slip::Val& v) {
+    if (const slip::List* l = boost::get<slip::List>(&v)) {
+        size_t n = 1;
+        for (auto& x : *l) {
+            n += CountNodes(x);
+        }
+        return n;
+    }
+    return 1;
+}
+
+void bench_parse() {
+    using namespace slip;
+    const std::pair<std::string, std::string> scripts[] = {
+        {"wide", WideScript(20000)},
+        {"nested", NestedScript(1000)},
+        {"long-tokens", LongTokensScript(5000)}};
+    for (auto& script : scripts) {
+        for (auto kind :
+             {ParserKind::Combinator, ParserKind::RecursiveDescent}) {
+            double secs = Time([&] {
+                auto res = Parse(script.second, kind);
+                if (!res) {
+                    throw std::runtime_error("parse failed");
+                }
+            });
+            Report("parse/" + script.first +
+                       (kind == ParserKind::Combinator ? "/combinator"
+                                                       : "/recursive-descent"),
+                   secs,
+                   script.second.size());
+        }
+    }
+}
+
+void bench_flat_ast() {
+    using namespace slip;
+    Context ctx;
+    ctx.ImportBase();
+    std::string script = ArithScript(14);
+
+    size_t before = g_live_bytes, allocs = g_allocs;
+    auto tree = ParseRD(script);
+    size_t nodes = CountNodes(tree->first);
+    std::cout << "ast/tree: " << nodes << " nodes, "
+              << double(g_live_bytes - before) / nodes << " bytes/node, "
+              << double(g_allocs - allocs) / nodes << " allocs/node\n";
+
+    before = g_live_bytes, allocs = g_allocs;
+    auto flat = ParseFlat(script);
+    std::cout << "ast/flat: " << flat->first.node_count() << " nodes, "
+              << double(g_live_bytes - before) / flat->first.node_count()
+              << " bytes/node, " << g_allocs - allocs << " allocs\n";
+
+    FlatVal root = flat->first.root();
+    Report("ast/tree/typecheck",
+           Time([&] { TypeExpression(tree->first, ctx); }),
+           script.size());
+    Report("ast/flat/typecheck",
+           Time([&] { TypeExpression(root, ctx); }),
+           script.size());
+    Report("ast/tree/eval",
+           Time([&] { Eval<int>(tree->first, ctx); }),
+           script.size());
+    Report("ast/flat/eval", Time([&] { Eval<int>(root, ctx); }), script.size());
+    TypedAst typed = Annotate(tree->first, ctx);
+    Report("ast/typed/annotate",
+           Time([&] { Annotate(tree->first, ctx); }),
+           script.size());
+    Report("ast/typed/eval",
+           Time([&] { Eval<int>(typed, ctx); }),
+           script.size());
+    Report("ast/tree/print", Time([&] { Print(tree->first); }), script.size());
+    Report("ast/flat/print", Time([&] { Print(root); }), script.size());
+}
+
+// The ambiguous grammar of parcxx's packrat test:
+// sum := term '+' sum | term '-' sum | term
+// term := '(' sum ')' | digit
+struct SumGrammar {
+    template <class P>
+    static Parser<int> maybe_memo(bool memoize, P p) {
+        if (memoize) {
+            return memo(p);
+        }
+        return p;
+    }
+
+    explicit SumGrammar(bool memoize)
+        : term(maybe_memo(
+              memoize,
+              (parse_char('(') >> recursion(sum) << parse_char(')')) |
+                  parse_digit())),
+          sum(maybe_memo(memoize,
+                         (((recursion(term) << parse_char('+')) &
+                           recursion(sum)) %
+                          [](auto x) { return x.first + x.second; }) |
+                             (((recursion(term) << parse_char('-')) &
+                               recursion(sum)) %
+                              [](auto x) { return x.first - x.second; }) |
+                             recursion(term))) {}
+
+    Parser<int> term;
+    Parser<int> sum;
+};
+
+void bench_packrat() {
+    SumGrammar plain(false);
+    SumGrammar memoized(true);
+    auto with_packrat = packrat(recursion(memoized.sum));
+
+    // Backtracking over nested parens is exponential without memoization...
+    for (int depth : {2, 4, 8, 11}) {
+        std::string nested = "1";
+        for (int i = 0; i < depth; ++i) {
+            nested = "(1+" + nested + ")";
+        }
+        Report("packrat/nested-" + std::to_string(depth) + "/plain",
+               Time([&] { plain.sum(nested.begin(), nested.end()); }, 0.1),
+               nested.size());
+        Report("packrat/nested-" + std::to_string(depth) + "/packrat",
+               Time([&] { with_packrat(nested.begin(), nested.end()); }, 0.1),
+               nested.size());
+    }
+
+    // ... but a grammar that rarely backtracks only pays for the table.
+    std::string flat = "1";
+    for (int i = 0; i < 1000; ++i) {
+        flat += "+1";
+    }
+    Report("packrat/flat/plain",
+           Time([&] { plain.sum(flat.begin(), flat.end()); }),
+           flat.size());
+    Report("packrat/flat/packrat",
+           Time([&] { with_packrat(flat.begin(), flat.end()); }),
+           flat.size());
+}
+
+// SumGrammar as statically typed rules.
+struct TermRule;
+
+struct SumRule {
+    template <class Self>
+    static auto build(Self self) {
+        auto term = rule<int, TermRule>();
+        return (((term << parse_char('+')) & self) %
+                [](auto x) { return x.first + x.second; }) |
+               (((term << parse_char('-')) & self) %
+                [](auto x) { return x.first - x.second; }) |
+               term;
+    }
+};
+
+struct TermRule {
+    template <class Self>
+    static auto build(Self) {
+        return (parse_char('(') >> rule<int, SumRule>() << parse_char(')')) |
+               parse_digit();
+    }
+};
+
+// Recursion through std::function, as Parser<T> and recursion() do, against
+// statically typed rules and the parser_ref handle.
+void bench_rules() {
+    using namespace slip;
+    size_t allocs = g_allocs;
+    Parser<Val> erased = ExprGrammar::build(recursion(erased));
+    std::cout << "rules/build/std::function: " << g_allocs - allocs
+              << " allocs\n";
+    allocs = g_allocs;
+    auto expr = ParseExpr();
+    expr(str_iterator(), str_iterator());
+    std::cout << "rules/build/rule: " << g_allocs - allocs << " allocs\n";
+    auto ref = parser_ref(expr);
+
+    const std::pair<std::string, std::string> scripts[] = {
+        {"wide", WideScript(20000)}, {"nested", NestedScript(1000)}};
+    for (auto& script : scripts) {
+        auto b = script.second.begin(), e = script.second.end();
+        Report("rules/" + script.first + "/std::function",
+               Time([&] { erased(b, e); }),
+               script.second.size());
+        Report("rules/" + script.first + "/rule",
+               Time([&] { expr(b, e); }),
+               script.second.size());
+        Report("rules/" + script.first + "/parser_ref",
+               Time([&] { ref(b, e); }),
+               script.second.size());
+    }
+
+    SumGrammar plain(false);
+    auto sum = rule<int, SumRule>();
+    std::string flat = "1";
+    for (int i = 0; i < 1000; ++i) {
+        flat += "+(1-1)";
+    }
+    Report("rules/sum/std::function",
+           Time([&] { plain.sum(flat.begin(), flat.end()); }),
+           flat.size());
+    Report("rules/sum/rule",
+           Time([&] { sum(flat.begin(), flat.end()); }),
+           flat.size());
+}
+
+// Reading a script file into a string before parsing it, against parsing
+// the mapped file in place.
+void bench_file() {
+    using namespace slip;
+    char path[] = "/tmp/slip-bench-XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    std::string script = WideScript(200000);
+    std::ofstream(path) << script;
+
+    Report("file/read+parse",
+           Time([&] {
+               std::ifstream in(path);
+               std::stringstream content;
+               content << in.rdbuf();
+               ParseScript(std::make_shared<const std::string>(content.str()));
+           }),
+           script.size());
+    Report("file/mmap+parse", Time([&] { ParseFile(path); }), script.size());
+    std::remove(path);
+}
+
+// A stream that waits before handing out each chunk, like a disk or a
+// network would.
+class SlowStreamBuf : public std::streambuf {
+   public:
+    SlowStreamBuf(const std::string& data, size_t chunk, int delay_us)
+        : data_(data), chunk_(chunk), delay_us_(delay_us) {}
+
+   protected:
+    int_type underflow() override {
+        if (pos_ == data_.size()) {
+            return traits_type::eof();
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(delay_us_));
+        size_t n = std::min(chunk_, data_.size() - pos_);
+        char* b = const_cast<char*>(data_.data()) + pos_;
+        setg(b, b, b + n);
+        pos_ += n;
+        return traits_type::to_int_type(*b);
+    }
+
+   private:
+    const std::string& data_;
+    size_t chunk_;
+    int delay_us_;
+    size_t pos_ = 0;
+};
+
+// Replaying a log of scripts: reading, parsing and running each form in turn
+// against the Loader, which reads and parses ahead on its own thread.
+void bench_loader() {
+    using namespace slip;
+    Context ctx;
+    ctx.ImportBase();
+    std::string log;
+    for (int i = 0; i < 5000; ++i) {
+        log += ArithScript(6) + "\n";
+    }
+
+    for (int delay_us : {0, 500}) {
+        std::string name =
+            "loader/" + (delay_us ? "slow-stream" : std::string("memory"));
+        Report(name + "/sequential",
+               Time([&] {
+                   SlowStreamBuf buf(log, 16 << 10, delay_us);
+                   std::istream in(&buf);
+                   FormReader reader(in, 16 << 10, 1 << 20);
+                   Val form;
+                   while (reader.Next(form)) {
+                       TypeCheck(form, ctx);
+                       Eval<Polymorphic>(form, ctx);
+                   }
+               }),
+               log.size());
+        Loader::Options opts;
+        opts.chunk_size = 16 << 10;
+        Loader loader(ctx, opts);
+        Report(name + "/pipelined",
+               Time([&] {
+                   SlowStreamBuf buf(log, 16 << 10, delay_us);
+                   std::istream in(&buf);
+                   loader.Run(in, [](const Val&, Polymorphic&) {});
+               }),
+               log.size());
+    }
+}
+
+// The binary encoding against the text grammar, in size and in speed.
+// Throughputs are relative to the size of the text, so that they compare
+// the time to get the same tree.
+void bench_wire() {
+    using namespace slip;
+    const std::pair<std::string, std::string> scripts[] = {
+        {"wide", WideScript(20000)},
+        {"arith", ArithScript(14)},
+        {"long-tokens", LongTokensScript(5000)}};
+    for (auto& script : scripts) {
+        auto text = std::make_shared<const std::string>(script.second);
+        auto wire = std::make_shared<const std::string>(
+            Serialize(ParseRD(*text)->first));
+        std::cout << "wire/" << script.first << ": " << text->size()
+                  << " bytes of text, " << wire->size() << " bytes of wire ("
+                  << 100 * wire->size() / text->size() << "%)\n";
+        std::string name = "wire/" + script.first;
+        size_t size = text->size();
+        Report(name + "/parse", Time([&] { ParseRD(*text); }), size);
+        Report(name + "/deserialize", Time([&] { Deserialize(*wire); }), size);
+        Report(name + "/parse-borrowed",
+               Time([&] { ParseScript(text); }),
+               size);
+        Report(name + "/deserialize-borrowed",
+               Time([&] { DeserializeScript(wire); }),
+               size);
+        Report(name + "/parse-flat", Time([&] { ParseFlat(*text); }), size);
+        Report(name + "/deserialize-flat",
+               Time([&] { DeserializeFlat(*wire); }),
+               size);
+        auto tree = ParseRD(*text);
+        Report(name + "/serialize",
+               Time([&] { Serialize(tree->first); }),
+               size);
+    }
+}
+
+// A balanced tree of polymorphic calls: (if (== a b) x y) and (const x y).
+std::string PolyScript(int depth) {
+    if (depth == 0) {
+        return "1";
+    }
+    std::string sub = PolyScript(depth - 1);
+    if (depth % 2) {
+        return "(if (== " + sub + " 1) " + sub + " 2)";
+    }
+    return "(const " + sub + " " + sub + ")";
+}
+
+// (compose f g) trees over partially applied arithmetic.
+std::string ComposeScript(int depth) {
+    if (depth == 0) {
+        return "(+ 1)";
+    }
+    std::string sub = ComposeScript(depth - 1);
+    return "(compose " + sub + " " + sub + ")";
+}
+
+// Typechecking large generated scripts, with and without the ApplyCache.
+void bench_typecheck() {
+    using namespace slip;
+    Context ctx;
+    ctx.ImportBase();
+    ctx.DeclareFun("compose",
+                   "(b -> c) -> (a -> b) -> a -> c",
+                   [](const Polymorphic& f, const Polymorphic&) { return f; });
+    const std::pair<std::string, std::string> scripts[] = {
+        {"arith", ArithScript(14)},
+        {"poly", PolyScript(9)},
+        {"compose", ComposeScript(12)}};
+
+    // Prototypes, allocations included.
+    for (const char* type : {"Int -> Int", "a -> b -> a"}) {
+        Prototype proto = ParseType(type);
+        size_t before = g_live_bytes;
+        std::vector<Prototype> protos(1000, proto);
+        std::cout << "typecheck/prototype (" << type
+                  << "): " << (g_live_bytes - before) / protos.size()
+                  << " bytes\n";
+    }
+
+    // Not to measure the TypeCache instead of the ApplyCache.
+    ctx.type_cache().set_capacity(0);
+    ApplyCache& cache = ApplyCache::Global();
+    size_t capacity = cache.capacity();
+    for (auto& script : scripts) {
+        auto tree = ParseRD(script.second);
+        cache.set_capacity(0);
+        Report("typecheck/" + script.first + "/uncached",
+               Time([&] { TypeCheck(tree->first, ctx); }),
+               script.second.size());
+        cache.set_capacity(capacity);
+        Report("typecheck/" + script.first + "/cached",
+               Time([&] { TypeCheck(tree->first, ctx); }),
+               script.second.size());
+        std::cout << "typecheck/" + script.first + "/cache: " << cache.hits()
+                  << " hits, " << cache.misses() << " misses, "
+                  << cache.size() << " entries\n";
+    }
+}
+
+// A host checking requests that come in a few shapes, each freshly parsed,
+// with TypeCheck() then TypeExpression() like the repl.
+void bench_type_cache() {
+    using namespace slip;
+    Context ctx;
+    ctx.ImportBase();
+    const std::string shapes[] = {
+        "(+ 1 2)",
+        "(if (< 1 2) \"yes\" \"no\")",
+        "(+s \"user:\" (if (== 3 4) \"a\" \"b\"))",
+        "(and (or (< 1 2) (> 3 4)) (not (== 5 6)))",
+        "(const (+ (* 2 3) (- 7 1)) (if true \"x\" \"y\"))",
+        ArithScript(4),
+        ArithScript(6),
+        PolyScript(3)};
+    std::vector<Val> requests;
+    for (int i = 0; i < 1000; ++i) {
+        requests.push_back(ParseRD(shapes[i % 8])->first);
+    }
+    // Calls of one shape with different arguments, as RPCs would be.
+    std::vector<Val> calls;
+    for (int i = 0; i < 1000; ++i) {
+        std::string n = std::to_string(i);
+        calls.push_back(ParseRD("(+ (* " + n + " 2) " + n + ")")->first);
+    }
+    TypeCache& cache = ctx.type_cache();
+    for (auto* batch : {&requests, &calls}) {
+        for (size_t capacity : {0, 1024}) {
+            cache.set_capacity(capacity);
+            double secs = Time([&] {
+                for (Val& request : *batch) {
+                    TypeCheck(request, ctx);
+                    TypeExpression(request, ctx);
+                }
+            });
+            std::cout << "type-cache/" << (batch == &calls ? "calls/" : "")
+                      << (capacity ? "cached" : "uncached") << ": "
+                      << secs / batch->size() * 1e9 << " ns/request, "
+                      << cache.hits() << " hits, " << cache.misses()
+                      << " misses\n";
+        }
+    }
+}
+
+// The same requests with different values, parsed and checked every time,
+// then prepared once.
+void bench_prepared() {
+    using namespace slip;
+    Context ctx;
+    ctx.ImportBase();
+    const int n = 1000;
+    std::vector<std::string> names;
+    for (int i = 0; i < n; ++i) {
+        names.push_back("user" + std::to_string(i));
+    }
+    // Its placeholders are arguments of a special function.
+    const std::string greet =
+        "(if (< (* ?0 3) 1500) (+s ?1 \"!\") (+s \"big \" ?1))";
+    const std::string arith = "(- (* ?0 ?0) (+ (* 2 ?1) (% ?0 7)))";
+    auto bind = [](std::string script, int i, const std::string& name) {
+        size_t pos;
+        while ((pos = script.find("?0")) != std::string::npos) {
+            script.replace(pos, 2, std::to_string(i));
+        }
+        while ((pos = script.find("?1")) != std::string::npos) {
+            script.replace(pos, 2, name);
+        }
+        return script;
+    };
+    std::vector<std::string> greets, ariths;
+    for (int i = 0; i < n; ++i) {
+        greets.push_back(bind(greet, i, "\"" + names[i] + "\""));
+        ariths.push_back(bind(arith, i, std::to_string(i + 1)));
+    }
+
+    auto report = [&](const std::string& name, double secs) {
+        std::cout << "prepared/" << name << ": " << secs / n * 1e9
+                  << " ns/request\n";
+    };
+    report("greet/parse+check+eval", Time([&] {
+               for (auto& script : greets) {
+                   auto tree = ParseRD(script);
+                   TypeCheck(tree->first, ctx);
+                   Eval<std::string>(tree->first, ctx);
+               }
+           }));
+    PreparedScript prepared_greet(ctx, greet);
+    report("greet/run", Time([&] {
+               for (int i = 0; i < n; ++i) {
+                   prepared_greet.Run<std::string>(i, names[i]);
+               }
+           }));
+    report("arith/parse+check+eval", Time([&] {
+               for (auto& script : ariths) {
+                   auto tree = ParseRD(script);
+                   TypeCheck(tree->first, ctx);
+                   Eval<int>(tree->first, ctx);
+               }
+           }));
+    PreparedScript prepared_arith(ctx, arith);
+    report("arith/run", Time([&] {
+               for (int i = 0; i < n; ++i) {
+                   prepared_arith.Run<int>(i, i + 1);
+               }
+           }));
+}
+
+// A balanced tree of calls to host functions, 2^depth leaves.
+std::string CallScript(int depth) {
+    if (depth == 0) {
+        return "1";
+    }
+    std::string sub = CallScript(depth - 1);
+    return "(max (inc " + sub + ") " + sub + ")";
+}
+
+// Evaluating the same script from its tree, linked or not, its annotated tree
+// and its bytecode.
+void bench_bytecode() {
+    using namespace slip;
+    Context ctx;
+    ctx.ImportBase();
+    ctx.DeclareFun("max", [](int a, int b) -> int { return a > b ? a : b; });
+    ctx.DeclareFun("inc", [](int a) -> int { return a + 1; });
+    const std::pair<std::string, std::string> scripts[] = {
+        {"arith", ArithScript(12)}, {"calls", CallScript(12)}};
+    for (auto& script : scripts) {
+        auto tree = ParseRD(script.second);
+        TypeCheck(tree->first, ctx);
+        TypedAst typed = Annotate(tree->first, ctx);
+        Bytecode code = Compile(tree->first, ctx);
+        auto report = [&](const std::string& name, double secs) {
+            std::cout << "bytecode/" << script.first << "/" << name << ": "
+                      << secs * 1e6 << " us/run\n";
+        };
+        report("tree", Time([&] { Eval<int>(tree->first, ctx); }));
+        Link(tree->first, ctx);
+        report("linked", Time([&] { Eval<int>(tree->first, ctx); }));
+        report("typed", Time([&] { Eval<int>(typed, ctx); }));
+        report("bytecode", Time([&] { Eval<int>(code, ctx); }));
+        report("compile", Time([&] { Compile(tree->first, ctx); }));
+    }
+}
+
+// Heap allocations per call evaluated from a tree, or an annotated one.
+void bench_closures() {
+    using namespace slip;
+    Context ctx;
+    ctx.ImportBase();
+    ctx.DeclareFun("max", [](int a, int b) -> int { return a > b ? a : b; });
+    ctx.DeclareFun("inc", [](int a) -> int { return a + 1; });
+    ctx.DeclareFun("len", [](const std::string& s) -> int { return s.size(); });
+    std::string strings = "1";
+    for (int i = 0; i < 100; ++i) {
+        strings = "(+ (len (+s \"ab\" \"cd\")) " + strings + ")";
+    }
+    const std::pair<std::string, std::string> scripts[] = {
+        {"arith", ArithScript(12)},
+        {"calls", CallScript(12)},
+        {"strings", strings},
+        {"curried", "((if (< 1 2) (+) (*)) 2 3)"}};
+    for (auto& script : scripts) {
+        auto tree = ParseRD(script.second);
+        TypeCheck(tree->first, ctx);
+        Link(tree->first, ctx);
+        TypedAst typed = Annotate(tree->first, ctx);
+        size_t calls = 0;
+        for (uint32_t i = 0; i < typed.node_count(); ++i) {
+            calls += typed.node(i).kind == TypedAst::Kind::List;
+        }
+        size_t allocs = g_allocs;
+        Eval<int>(tree->first, ctx);
+        std::cout << "closures/" << script.first << "/tree: "
+                  << double(g_allocs - allocs) / calls << " allocs/call\n";
+        allocs = g_allocs;
+        Eval<int>(typed, ctx);
+        std::cout << "closures/" << script.first << "/typed: "
+                  << double(g_allocs - allocs) / calls << " allocs/call\n";
+        std::cout << "closures/" << script.first << "/tree: "
+                  << Time([&] { Eval<int>(tree->first, ctx); }) / calls * 1e9
+                  << " ns/call\n";
+    }
+}
+
+// Lookups of names interned already, as parsing and evaluation do, from
+// several threads at once.
+void bench_symbols() {
+    using namespace slip;
+    std::vector<std::string> names;
+    for (int i = 0; i < 1000; ++i) {
+        names.push_back("symbol" + std::to_string(i));
+        SymbolTable::Global().Intern(names.back());
+    }
+    for (int threads : {1, 4}) {
+        std::atomic<int> sink(0);
+        double secs = Time([&] {
+            std::vector<std::thread> pool;
+            for (int t = 0; t < threads; ++t) {
+                pool.emplace_back([&] {
+                    int sum = 0;
+                    for (auto& name : names) {
+                        int id = SymbolTable::Global().Intern(name);
+                        sum += SymbolTable::Global().Name(id).size();
+                    }
+                    sink += sum;
+                });
+            }
+            for (auto& thread : pool) {
+                thread.join();
+            }
+        });
+        std::cout << "symbols/" << threads << "-threads: "
+                  << secs / (threads * names.size()) * 1e9
+                  << " ns/lookup\n";
+    }
+}
+
+void bench_polymorphic() {
+    using namespace slip;
+    const int kValues = 1000;
+    std::vector<Polymorphic> values;
+    for (int i = 0; i < kValues; ++i) {
+        values.emplace_back(i);
+    }
+    volatile int sink = 0;
+    std::cout << "polymorphic/as: "
+              << Time([&] {
+                     for (auto& x : values) {
+                         sink = sink + x.as<int>();
+                     }
+                 }) / kValues * 1e9
+              << " ns/value\n";
+    std::cout << "polymorphic/as-mismatch: "
+              << Time([&] {
+                     for (auto& x : values) {
+                         sink = sink + !x.as<std::string*>();
+                     }
+                 }) / kValues * 1e9
+              << " ns/value\n";
+    std::cout << "polymorphic/unchecked: "
+              << Time([&] {
+                     for (auto& x : values) {
+                         sink = sink + x.unchecked_as<int>();
+                     }
+                 }) / kValues * 1e9
+              << " ns/value\n";
+}
+
+// Registering a host API of many functions.
+void bench_declare() {
+    using namespace slip;
+    const int n = 10000;
+    std::vector<std::string> names;
+    for (int i = 0; i < n; ++i) {
+        names.push_back("fun" + std::to_string(i));
+    }
+    auto f = [](int a, const std::string& b, bool c) -> int {
+        return a + b.size() + c;
+    };
+    double secs = Time([&] {
+        Context ctx;
+        for (auto& name : names) {
+            ctx.DeclareFun(name, decltype(f)(f));
+        }
+    });
+    std::cout << "declare/signature: " << secs / n * 1e9 << " ns/function\n";
+    secs = Time([&] {
+        Context ctx;
+        for (auto& name : names) {
+            ctx.DeclareFun(
+                name, "Int -> String -> Bool -> Int", decltype(f)(f));
+        }
+    });
+    std::cout << "declare/type-string: " << secs / n * 1e9
+              << " ns/function\n";
+}
+
+int main(int argc, char** argv) {
+    const std::pair<std::string, std::function<void()>> benches[] = {
+        {"parse", bench_parse},
+        {"flat-ast", bench_flat_ast},
+        {"packrat", bench_packrat},
+        {"rules", bench_rules},
+        {"file", bench_file},
+        {"loader", bench_loader},
+        {"wire", bench_wire},
+        {"typecheck", bench_typecheck},
+        {"declare", bench_declare},
+        {"type-cache", bench_type_cache},
+        {"prepared", bench_prepared},
+        {"bytecode", bench_bytecode},
+        {"closures", bench_closures},
+        {"symbols", bench_symbols},
+        {"polymorphic", bench_polymorphic},
+    };
+    for (auto& b : benches) {
+        if (argc < 2 || b.first == argv[1]) {
+            b.second();
+        }
+    }
+    return 0;
+}
@@ -1,12 +1,17 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include <boost/variant.hpp>
 
+#include "symbol.h"
+
 namespace slip {
+class Function;
+
 struct Int {
    public:
     Int() = default;
@@ -30,24 +35,76 @@ struct Bool {
 
 struct Atom {
    public:
-    Atom(std::string s) : val_(s) {}
+    Atom(boost::string_view s) : sym_(SymbolTable::Global().Intern(s)) {}
+    Atom(const char* b, const char* e) : Atom(boost::string_view(b, e - b)) {}
     Atom(const Atom& x) = default;
-    const std::string& val() const { return val_; }
-    std::string& val() { return val_; }
+
+    static Atom FromSymbol(int sym) { return Atom(sym, 0); }
+
+    int symbol() const { return sym_; }
+    const std::string& val() const { return SymbolTable::Global().Name(sym_); }
+
+    // Which of the functions of that name type checking chose for this call.
+    // Binding it again unlinks the atom.
+    int overload() const { return overload_; }
+    void Bind(int overload) const {
+        overload_ = overload;
+        fun_ = nullptr;
+        stamp_ = 0;
+    }
+
+    // That function, once linked by Link(), if it was against the functions
+    // of the Context of that stamp, and nullptr otherwise.
+    Function* function(uint64_t stamp) const {
+        return stamp == stamp_ ? fun_ : nullptr;
+    }
+    void Link(Function* fun, uint64_t stamp) const {
+        fun_ = fun;
+        stamp_ = stamp;
+    }
+
+    bool operator==(const Atom& o) const { return sym_ == o.sym_; }
+    bool operator!=(const Atom& o) const { return sym_ != o.sym_; }
 
    private:
-    std::string val_;
+    Atom(int sym, int) : sym_(sym) {}
+
+    int sym_;
+    // Bound even through a const tree: like a cache, it doesn't change what
+    // the atom means.
+    mutable int overload_ = 0;
+    mutable Function* fun_ = nullptr;
+    mutable uint64_t stamp_ = 0;
 };
 
 struct Str {
    public:
-    Str(std::string s) : val_(std::move(s)) {}
-    Str(const Str& x) = default;
-    const std::string& val() const { return val_; }
-    std::string& val() { return val_; }
+    Str(std::string s) : owned_(std::move(s)) {}
+
+    // A literal that points into a buffer owned by someone else, who has to
+    // keep it alive as long as this Str and its copies. See Script.
+    static Str Borrow(boost::string_view v) {
+        Str s;
+        s.borrowed_ = v.data() ? v : boost::string_view("", 0);
+        return s;
+    }
+
+    // Copies, not views: callers that only read should use view().
+    std::string val() const { return view().to_string(); }
+    boost::string_view view() const {
+        return borrowed() ? borrowed_ : boost::string_view(owned_);
+    }
+    bool borrowed() const { return borrowed_.data() != nullptr; }
+    // nullptr for a borrowed literal.
+    const std::string* owned() const { return borrowed() ? nullptr : &owned_; }
 
    private:
-    std::string val_;
+    Str() = default;
+
+    std::string owned_;
+    // Only for a borrowed literal: the view of an owned one is made on
+    // demand, so that copies and moves are those of the members.
+    boost::string_view borrowed_;
 };
 
 class List;
@@ -58,16 +115,16 @@ class List {
    public:
     List(std::vector<Val> v) : vals_(std::move(v)) {}
 
-    const std::string* GetFunName() const {
+    const Atom* GetFunAtom() const {
         if (vals_.empty()) {
             return nullptr;
         }
+        return boost::get<Atom>(&vals_[0]);
+    }
 
-        if (const Atom* a = boost::get<Atom>(&vals_[0])) {
-            return &a->val();
-        } else {
-            return nullptr;
-        }
+    const std::string* GetFunName() const {
+        const Atom* a = GetFunAtom();
+        return a ? &a->val() : nullptr;
     }
     decltype(auto) begin() { return vals_.begin(); }
     decltype(auto) begin() const { return vals_.begin(); }
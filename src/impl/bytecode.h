@@ -0,0 +1,496 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "context.h"
+#include "eval.h"
+#include "function.h"
+#include "polymorphic.h"
+#include "typecheck.h"
+#include "typed-ast.h"
+
+// Instructions jump straight to the address of the next handler where the
+// compiler can take it, and go through a switch otherwise.
+#if defined(__GNUC__)
+#define SLIP_THREADED_VM 1
+#endif
+
+namespace slip {
+// A script compiled for a register machine. Builtins of ImportBase() are
+// single instructions, ints and bools stay unboxed in registers, and other
+// functions are called directly on registers. What doesn't compile, like
+// partial applications and special functions other than if, is evaluated
+// from the annotated tree like Eval() does.
+//
+//   Bytecode code = Compile(*res->first, ctx);
+//   int x = Eval<int>(code, ctx);
+//
+// Like a TypedAst, it must outlive neither the script nor the functions of
+// ctx. It may run in several threads at once.
+class Bytecode {
+   public:
+    enum class Op : uint8_t {
+        LoadInt,
+        LoadConst,
+        BoxInt,
+        BoxBool,
+        UnboxInt,
+        UnboxBool,
+        Add,
+        Sub,
+        Mul,
+        Div,
+        Mod,
+        Eq,
+        Le,
+        Ge,
+        Lt,
+        Gt,
+        Not,
+        And,
+        Or,
+        Jump,
+        JumpIfNot,
+        Call,
+        Tree,
+        Return
+    };
+
+    // Operands are registers, but for LoadInt: a is the int, LoadConst: a
+    // indexes the constants, Jump: a is the target, JumpIfNot: b is, Call:
+    // a is the first argument, and Tree: a is the node, b its Repr.
+    struct Instr {
+        // The handler of op, when threaded.
+        const void* handler;
+        Function* fun;
+        Op op;
+        uint32_t dst;
+        uint32_t a;
+        uint32_t b;
+    };
+
+    Type type() const { return typed_.root().type(); }
+    size_t size() const { return code_.size(); }
+    const Instr& instr(size_t i) const { return code_[i]; }
+
+    // T must fit type().
+    template <class T>
+    T Run(Context& ctx) const;
+
+   private:
+    friend class BytecodeCompiler;
+    friend Bytecode Compile(const Val& x, Context& ctx);
+
+    // Runs the code with its registers in regs. With regs null, only returns
+    // the handlers of the ops, in order, for the code to be threaded with.
+    const void* const* Execute(Register* regs, Context* ctx) const;
+
+    TypedAst typed_;
+    std::vector<Instr> code_;
+    std::vector<Polymorphic> constants_;
+    uint32_t registers_ = 1;
+};
+
+namespace {
+Repr ReprOf(Type ty) {
+    if (ty == TypeOf<int>()) {
+        return Repr::Int;
+    }
+    return ty == TypeOf<bool>() ? Repr::Bool : Repr::Boxed;
+}
+
+// The result of a script, from the register it's left in.
+template <class T>
+struct TakeResult {
+    static T Take(Register& r, Repr) {
+        return std::move(r.obj.unchecked_as<T>());
+    }
+};
+
+template <>
+struct TakeResult<int> {
+    static int Take(Register& r, Repr) { return r.num; }
+};
+
+template <>
+struct TakeResult<bool> {
+    static bool Take(Register& r, Repr) { return r.num; }
+};
+
+template <>
+struct TakeResult<Polymorphic> {
+    static Polymorphic Take(Register& r, Repr repr) {
+        switch (repr) {
+            case Repr::Int:
+                return r.num;
+            case Repr::Bool:
+                return static_cast<bool>(r.num);
+            default:
+                return std::move(r.obj);
+        }
+    }
+};
+}  // namespace
+
+class BytecodeCompiler {
+    using Op = Bytecode::Op;
+    using Kind = TypedAst::Kind;
+
+   public:
+    explicit BytecodeCompiler(Bytecode& code) : code_(code) {}
+
+    // Leaves the value of node idx in register dst, as want.
+    void Compile(uint32_t idx, uint32_t dst, Repr want) {
+        const TypedAst::Node& x = code_.typed_.node(idx);
+        Repr have = ReprOf(x.type);
+        switch (x.kind) {
+            case Kind::Int:
+            case Kind::Bool:
+                Emit(Op::LoadInt, dst, x.value);
+                break;
+            case Kind::Str:
+                code_.constants_.push_back(boost::get<Str>(*x.val).val());
+                Emit(Op::LoadConst, dst, code_.constants_.size() - 1);
+                break;
+            default:
+                if (!CompileCall(idx, dst, &have)) {
+                    Emit(Op::Tree, dst, idx, static_cast<uint32_t>(have));
+                }
+        }
+        Convert(dst, have, want);
+    }
+
+    size_t Emit(Op op,
+                uint32_t dst,
+                uint32_t a = 0,
+                uint32_t b = 0,
+                Function* fun = nullptr) {
+        code_.code_.push_back({nullptr, fun, op, dst, a, b});
+        return code_.code_.size() - 1;
+    }
+
+   private:
+    // Registers above those in use, for temporaries.
+    uint32_t Temp() {
+        code_.registers_ = std::max(code_.registers_, next_ + 1);
+        return next_++;
+    }
+
+    void Convert(uint32_t reg, Repr have, Repr want) {
+        if (have == want) {
+            return;
+        }
+        if (want == Repr::Boxed) {
+            Emit(have == Repr::Int ? Op::BoxInt : Op::BoxBool, reg);
+        } else if (have == Repr::Boxed) {
+            Emit(want == Repr::Int ? Op::UnboxInt : Op::UnboxBool, reg);
+        }
+    }
+
+    // Calls a named function with all its arguments, into dst.
+    bool CompileCall(uint32_t idx, uint32_t dst, Repr* have) {
+        const TypedAst& ast = code_.typed_;
+        const TypedAst::Node& x = ast.node(idx);
+        if (x.size == 0 || x.arity < 0 ||
+            x.size - 1 != static_cast<uint32_t>(x.arity)) {
+            return false;
+        }
+        Function* fun = ast.node(idx + 1).fun;
+        uint32_t args[3];
+        uint32_t arity = 0;
+        for (uint32_t arg = ast.end(idx + 1); arg != ast.end(idx);
+             arg = ast.end(arg)) {
+            if (arity < 3) {
+                args[arity] = arg;
+            }
+            ++arity;
+        }
+        uint32_t saved = next_;
+        switch (fun->intrinsic()) {
+            case Intrinsic::None: {
+                if (fun->special()) {
+                    return false;
+                }
+                uint32_t first = next_;
+                for (uint32_t i = 0; i < arity; ++i) {
+                    Temp();
+                }
+                uint32_t i = 0;
+                for (uint32_t arg = ast.end(idx + 1); arg != ast.end(idx);
+                     arg = ast.end(arg), ++i) {
+                    Compile(arg, first + i, fun->repr(i));
+                }
+                Emit(Op::Call, dst, first, 0, fun);
+                *have = fun->repr(arity);
+                break;
+            }
+            case Intrinsic::If: {
+                Compile(args[0], dst, Repr::Bool);
+                size_t to_else = Emit(Op::JumpIfNot, 0, dst);
+                Compile(args[1], dst, *have);
+                size_t to_end = Emit(Op::Jump, 0);
+                code_.code_[to_else].b = code_.code_.size();
+                Compile(args[2], dst, *have);
+                code_.code_[to_end].a = code_.code_.size();
+                break;
+            }
+            case Intrinsic::Return:
+                Compile(args[0], dst, *have);
+                break;
+            case Intrinsic::Const:
+                Compile(args[0], dst, *have);
+                Compile(args[1], Temp(), ReprOf(ast.node(args[1]).type));
+                break;
+            case Intrinsic::Not:
+                Compile(args[0], dst, Repr::Bool);
+                Emit(Op::Not, dst, dst);
+                *have = Repr::Bool;
+                break;
+            default: {
+                bool logic = fun->intrinsic() == Intrinsic::And ||
+                             fun->intrinsic() == Intrinsic::Or;
+                Repr operand = logic ? Repr::Bool : Repr::Int;
+                Compile(args[0], dst, operand);
+                uint32_t rhs = Temp();
+                Compile(args[1], rhs, operand);
+                Emit(BinaryOp(fun->intrinsic()), dst, dst, rhs);
+                *have = fun->intrinsic() < Intrinsic::Eq ? Repr::Int
+                                                         : Repr::Bool;
+            }
+        }
+        next_ = saved;
+        return true;
+    }
+
+    static Op BinaryOp(Intrinsic op) {
+        switch (op) {
+            case Intrinsic::Add:
+                return Op::Add;
+            case Intrinsic::Sub:
+                return Op::Sub;
+            case Intrinsic::Mul:
+                return Op::Mul;
+            case Intrinsic::Div:
+                return Op::Div;
+            case Intrinsic::Mod:
+                return Op::Mod;
+            case Intrinsic::Eq:
+                return Op::Eq;
+            case Intrinsic::Le:
+                return Op::Le;
+            case Intrinsic::Ge:
+                return Op::Ge;
+            case Intrinsic::Lt:
+                return Op::Lt;
+            case Intrinsic::Gt:
+                return Op::Gt;
+            case Intrinsic::And:
+                return Op::And;
+            default:
+                return Op::Or;
+        }
+    }
+
+    Bytecode& code_;
+    // Register 0 holds the result.
+    uint32_t next_ = 1;
+};
+
+// Compiles x, which must outlive the result. It is type checked on the way,
+// like Annotate() does.
+Bytecode Compile(const Val& x, Context& ctx) {
+    Bytecode code;
+    code.typed_ = Annotate(x, ctx);
+    BytecodeCompiler compiler(code);
+    compiler.Compile(0, 0, ReprOf(code.type()));
+    compiler.Emit(Bytecode::Op::Return, 0);
+    if (const void* const* handlers = code.Execute(nullptr, nullptr)) {
+        for (Bytecode::Instr& instr : code.code_) {
+            instr.handler = handlers[static_cast<int>(instr.op)];
+        }
+    }
+    return code;
+}
+
+#ifdef SLIP_THREADED_VM
+#define SLIP_OP(op) op:
+#define SLIP_NEXT() goto*(++pc)->handler
+#define SLIP_JUMP(target) \
+    pc = code + (target); \
+    goto* pc->handler
+#else
+#define SLIP_OP(op) case Op::op:
+#define SLIP_NEXT() \
+    ++pc;           \
+    continue
+#define SLIP_JUMP(target)     \
+    pc = code + (target);     \
+    continue
+#endif
+
+const void* const* Bytecode::Execute(Register* regs, Context* ctx) const {
+#ifdef SLIP_THREADED_VM
+    static const void* const handlers[] = {
+        &&LoadInt, &&LoadConst, &&BoxInt,  &&BoxBool, &&UnboxInt, &&UnboxBool,
+        &&Add,     &&Sub,       &&Mul,     &&Div,     &&Mod,      &&Eq,
+        &&Le,      &&Ge,        &&Lt,      &&Gt,      &&Not,      &&And,
+        &&Or,      &&Jump,      &&JumpIfNot, &&Call,  &&Tree,     &&Return};
+    if (!regs) {
+        return handlers;
+    }
+#else
+    if (!regs) {
+        return nullptr;
+    }
+#endif
+    const Instr* code = code_.data();
+    const Instr* pc = code;
+#ifdef SLIP_THREADED_VM
+    goto* pc->handler;
+#else
+    for (;;) {
+        switch (pc->op) {
+#endif
+    SLIP_OP(LoadInt) {
+        regs[pc->dst].num = static_cast<int>(pc->a);
+        SLIP_NEXT();
+    }
+    SLIP_OP(LoadConst) {
+        regs[pc->dst].obj = constants_[pc->a];
+        SLIP_NEXT();
+    }
+    SLIP_OP(BoxInt) {
+        regs[pc->dst].obj = Polymorphic(regs[pc->dst].num);
+        SLIP_NEXT();
+    }
+    SLIP_OP(BoxBool) {
+        regs[pc->dst].obj = Polymorphic(static_cast<bool>(regs[pc->dst].num));
+        SLIP_NEXT();
+    }
+    SLIP_OP(UnboxInt) {
+        regs[pc->dst].num = regs[pc->dst].obj.unchecked_as<int>();
+        SLIP_NEXT();
+    }
+    SLIP_OP(UnboxBool) {
+        regs[pc->dst].num = regs[pc->dst].obj.unchecked_as<bool>();
+        SLIP_NEXT();
+    }
+    SLIP_OP(Add) {
+        regs[pc->dst].num = regs[pc->a].num + regs[pc->b].num;
+        SLIP_NEXT();
+    }
+    SLIP_OP(Sub) {
+        regs[pc->dst].num = regs[pc->a].num - regs[pc->b].num;
+        SLIP_NEXT();
+    }
+    SLIP_OP(Mul) {
+        regs[pc->dst].num = regs[pc->a].num * regs[pc->b].num;
+        SLIP_NEXT();
+    }
+    SLIP_OP(Div) {
+        regs[pc->dst].num = regs[pc->a].num / regs[pc->b].num;
+        SLIP_NEXT();
+    }
+    SLIP_OP(Mod) {
+        regs[pc->dst].num = regs[pc->a].num % regs[pc->b].num;
+        SLIP_NEXT();
+    }
+    SLIP_OP(Eq) {
+        regs[pc->dst].num = regs[pc->a].num == regs[pc->b].num;
+        SLIP_NEXT();
+    }
+    SLIP_OP(Le) {
+        regs[pc->dst].num = regs[pc->a].num <= regs[pc->b].num;
+        SLIP_NEXT();
+    }
+    SLIP_OP(Ge) {
+        regs[pc->dst].num = regs[pc->a].num >= regs[pc->b].num;
+        SLIP_NEXT();
+    }
+    SLIP_OP(Lt) {
+        regs[pc->dst].num = regs[pc->a].num < regs[pc->b].num;
+        SLIP_NEXT();
+    }
+    SLIP_OP(Gt) {
+        regs[pc->dst].num = regs[pc->a].num > regs[pc->b].num;
+        SLIP_NEXT();
+    }
+    SLIP_OP(Not) {
+        regs[pc->dst].num = !regs[pc->a].num;
+        SLIP_NEXT();
+    }
+    SLIP_OP(And) {
+        regs[pc->dst].num = regs[pc->a].num && regs[pc->b].num;
+        SLIP_NEXT();
+    }
+    SLIP_OP(Or) {
+        regs[pc->dst].num = regs[pc->a].num || regs[pc->b].num;
+        SLIP_NEXT();
+    }
+    SLIP_OP(Jump) { SLIP_JUMP(pc->a); }
+    SLIP_OP(JumpIfNot) {
+        if (!regs[pc->a].num) {
+            SLIP_JUMP(pc->b);
+        }
+        SLIP_NEXT();
+    }
+    SLIP_OP(Call) {
+        pc->fun->Call(regs + pc->a, regs[pc->dst]);
+        SLIP_NEXT();
+    }
+    SLIP_OP(Tree) {
+        TypedVal x(&typed_, pc->a);
+        Register& out = regs[pc->dst];
+        switch (static_cast<Repr>(pc->b)) {
+            case Repr::Int:
+                out.num = Eval<int>(x, *ctx);
+                break;
+            case Repr::Bool:
+                out.num = Eval<bool>(x, *ctx);
+                break;
+            case Repr::Boxed:
+                out.obj = Eval<Polymorphic>(x, *ctx);
+                break;
+        }
+        SLIP_NEXT();
+    }
+    SLIP_OP(Return) { return nullptr; }
+#ifndef SLIP_THREADED_VM
+        }
+    }
+#endif
+}
+
+#undef SLIP_OP
+#undef SLIP_NEXT
+#undef SLIP_JUMP
+
+template <class T>
+T Bytecode::Run(Context& ctx) const {
+    // Most scripts need few registers: those live on the stack.
+    Register local[16];
+    std::vector<Register> spilled;
+    Register* regs = local;
+    if (registers_ > 16) {
+        spilled.resize(registers_);
+        regs = spilled.data();
+    }
+    Execute(regs, &ctx);
+    return TakeResult<T>::Take(regs[0], ReprOf(type()));
+}
+
+// Only the type of the result is checked, against T.
+template <class T>
+T Eval(const Bytecode& code, Context& ctx) {
+    if (!EvaluatesTo<T>::Check(code.type())) {
+        throw std::runtime_error("can't evaluate an expression of type " +
+                                 Prototype(code.type()).Show());
+    }
+    return code.Run<T>(ctx);
+}
+}  // namespace slip
@@ -1,11 +1,18 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "ast.h"
+#include "flat-ast.h"
+#include "inline-box.h"
 #include "mangler.h"
 #include "polymorphic.h"
+#include "typed-ast.h"
 
 namespace slip {
 template <int>
@@ -15,15 +22,188 @@ class Context;
 
 template <class T>
 T Eval(const Val& x, Context& ctx);
+template <class T>
+T Eval(FlatVal x, Context& ctx);
+template <class T>
+T Eval(TypedVal x, Context& ctx);
+
+// Literals a string parameter can point to instead of copying them.
+inline const std::string* OwnedLiteral(const Val& x) {
+    const Str* s = boost::get<Str>(&x);
+    return s ? s->owned() : nullptr;
+}
+
+inline const std::string* OwnedLiteral(FlatVal) { return nullptr; }
+
+inline const std::string* OwnedLiteral(TypedVal x) {
+    switch (x.kind()) {
+        case TypedVal::Kind::Str:
+            return OwnedLiteral(x.val());
+        case TypedVal::Kind::Param:
+            return &x.param().unchecked_as<std::string>();
+        default:
+            return nullptr;
+    }
+}
+
+inline bool LiteralView(const Val& x, boost::string_view* out) {
+    if (const Str* s = boost::get<Str>(&x)) {
+        *out = s->view();
+        return true;
+    }
+    if (const Atom* a = boost::get<Atom>(&x)) {
+        *out = a->val();
+        return true;
+    }
+    return false;
+}
+
+inline bool LiteralView(FlatVal x, boost::string_view* out) {
+    if (x.kind() == FlatVal::Kind::Str || x.kind() == FlatVal::Kind::Atom) {
+        *out = x.view();
+        return true;
+    }
+    return false;
+}
+
+inline bool LiteralView(TypedVal x, boost::string_view* out) {
+    if (x.kind() == TypedVal::Kind::Param) {
+        *out = x.param().unchecked_as<std::string>();
+        return true;
+    }
+    return x.kind() == TypedVal::Kind::Str && LiteralView(x.val(), out);
+}
+
+// Where a closure keeps an argument until the call. Parameters are normally
+// evaluated into a value of their own.
+template <class T>
+class ArgSlot {
+   public:
+    using value_type = std::decay_t<T>;
+
+    template <class Node>
+    void Load(const Node& x, Context& ctx) {
+        value_ = Eval<value_type>(x, ctx);
+    }
+
+    const value_type& get() const { return value_; }
+
+    // Makes the slot keep a copy of what it points to, if anything.
+    void Own() {}
+
+   private:
+    value_type value_;
+};
+
+// A const std::string& parameter refers to the string literal of the tree
+// when there is one, so that it reaches the function without a copy. Copies
+// of the slot, and the closures Own() is called on, copy the string instead,
+// for them to outlive the tree.
+template <>
+class ArgSlot<const std::string&> {
+   public:
+    ArgSlot() = default;
+    ArgSlot(const ArgSlot& o)
+        : owned_(o.ptr_ ? *o.ptr_ : std::string()),
+          ptr_(o.ptr_ ? &owned_ : nullptr) {}
+    ArgSlot(ArgSlot&& o) noexcept
+        : owned_(std::move(o.owned_)),
+          ptr_(o.ptr_ == &o.owned_ ? &owned_ : o.ptr_) {}
+    ArgSlot& operator=(const ArgSlot&) = delete;
+
+    template <class Node>
+    void Load(const Node& x, Context& ctx) {
+        ptr_ = OwnedLiteral(x);
+        if (!ptr_) {
+            owned_ = Eval<std::string>(x, ctx);
+            ptr_ = &owned_;
+        }
+    }
+
+    const std::string& get() const { return *ptr_; }
+
+    void Own() {
+        if (ptr_ && ptr_ != &owned_) {
+            owned_ = *ptr_;
+            ptr_ = &owned_;
+        }
+    }
+
+   private:
+    std::string owned_;
+    const std::string* ptr_ = nullptr;
+};
+
+// Same for string views, which can also point to borrowed literals and atom
+// names.
+template <>
+class ArgSlot<boost::string_view> {
+   public:
+    ArgSlot() = default;
+    ArgSlot(const ArgSlot& o) : owned_(o.view_.to_string()), view_(owned_) {}
+    ArgSlot(ArgSlot&& o) noexcept : view_(o.view_) {
+        if (o.view_.data() == o.owned_.data()) {
+            owned_ = std::move(o.owned_);
+            view_ = owned_;
+        }
+    }
+    ArgSlot& operator=(const ArgSlot&) = delete;
+
+    template <class Node>
+    void Load(const Node& x, Context& ctx) {
+        if (!LiteralView(x, &view_)) {
+            owned_ = Eval<std::string>(x, ctx);
+            view_ = owned_;
+        }
+    }
+
+    boost::string_view get() const { return view_; }
+
+    void Own() {
+        if (view_.data() != owned_.data()) {
+            owned_ = view_.to_string();
+            view_ = owned_;
+        }
+    }
+
+   private:
+    std::string owned_;
+    boost::string_view view_;
+};
+
+template <>
+class ArgSlot<const boost::string_view&> : public ArgSlot<boost::string_view> {
+};
+
+template <class Args>
+struct ArgSlots;
+
+template <class... Args>
+struct ArgSlots<std::tuple<Args...>> {
+    using type = std::tuple<ArgSlot<Args>...>;
+};
 
 class ClosureBase {
    public:
     virtual void Apply(const Val& x, Context& ctx) = 0;
+    virtual void Apply(FlatVal x, Context& ctx) = 0;
+    virtual void Apply(TypedVal x, Context& ctx) = 0;
     virtual Polymorphic GetResult() const = 0;
+    // For a closure known to be totally applied.
+    virtual Polymorphic GetResultUnchecked() const = 0;
     virtual bool IsTotallyApplied() const = 0;
-    virtual ClosureBase* Copy() const = 0;
+    // Copies the arguments that point into the tree, for the closure to
+    // outlive it.
+    virtual void Own() = 0;
+    // See InlineBox.
+    virtual ClosureBase* CopyTo(void* buf) const = 0;
+    virtual ClosureBase* MoveTo(void* buf) = 0;
     virtual std::string Show() const = 0;
     virtual ~ClosureBase() {}
+
+    // Room for a closure of up to three arguments, strings included, so that
+    // evaluating a call doesn't allocate it.
+    using Box = InlineBox<ClosureBase, 112>;
 };
 
 template <class F>
@@ -38,50 +218,83 @@ class ClosureImpl : public ClosureBase {
         return Call(std::make_index_sequence<arity_>());
     }
 
+    Polymorphic GetResultUnchecked() const override {
+        return Call(std::make_index_sequence<arity_>());
+    }
+
     void Apply(const Val& x, Context& ctx) override {
         ApplyImpl(x, ctx, Number<0>());
         ++filled_args_;
     }
 
+    void Apply(FlatVal x, Context& ctx) override {
+        ApplyImpl(x, ctx, Number<0>());
+        ++filled_args_;
+    }
+
+    void Apply(TypedVal x, Context& ctx) override {
+        ApplyImpl(x, ctx, Number<0>());
+        ++filled_args_;
+    }
+
     bool IsTotallyApplied() const override { return filled_args_ == arity_; }
 
-    ClosureImpl(std::string name, F f)
-        : f_(std::move(f)), filled_args_(0), name_(std::move(name)) {}
+    void Own() override { OwnArgs(Number<0>()); }
+
+    ClosureImpl(const std::string& name, F f)
+        : f_(std::move(f)), filled_args_(0), name_(&name) {}
     ClosureImpl(const ClosureImpl&) = default;
+    ClosureImpl(ClosureImpl&&) = default;
 
-    ClosureBase* Copy() const override { return new ClosureImpl<F>(*this); }
+    ClosureBase* CopyTo(void* buf) const override {
+        return Box::Place<ClosureImpl>(buf, *this);
+    }
+    ClosureBase* MoveTo(void* buf) override {
+        return Box::Place<ClosureImpl>(buf, std::move(*this));
+    }
 
    private:
     static constexpr int arity_ = ManglerCaller<std::decay_t<F>>::arity;
 
-    template <int N>
-    void ApplyImpl(const Val& x, Context& ctx, Number<N>) {
+    template <class Node, int N>
+    void ApplyImpl(const Node& x, Context& ctx, Number<N>) {
         if (N == filled_args_) {
-            std::get<N>(args_) =
-                Eval<typename std::tuple_element<N, decltype(args_)>::type>(
-                    x, ctx);
+            std::get<N>(args_).Load(x, ctx);
         } else {
             ApplyImpl(x, ctx, Number<N + 1>());
         }
     }
 
-    void ApplyImpl(const Val&, Context&, Number<arity_>) {
+    template <class Node>
+    void ApplyImpl(const Node&, Context&, Number<arity_>) {
         throw std::runtime_error("No more remaining unfilled arguments");
     }
 
-    using args_type = typename ManglerCaller<std::decay_t<F>>::args_type;
+    template <int N>
+    void OwnArgs(Number<N>) {
+        std::get<N>(args_).Own();
+        OwnArgs(Number<N + 1>());
+    }
+
+    void OwnArgs(Number<arity_>) {}
+
+    using args_type = typename ArgSlots<
+        typename ManglerCaller<std::decay_t<F>>::raw_args_type>::type;
 
     template <size_t... Ns>
     auto Call(std::index_sequence<Ns...>) const {
-        return f_(std::get<Ns>(args_)...);
+        return f_(std::get<Ns>(args_).get()...);
     }
 
-    std::string Show() const override { return name_ + ShowArgs(Number<0>()); }
+    std::string Show() const override {
+        return *name_ + ShowArgs(Number<0>());
+    }
 
     template <int N>
     std::string ShowArgs(Number<N>) const {
         if (N < filled_args_) {
-            return " (" + (Polymorphic(std::get<N>(args_))).Show() + ")" +
+            return " (" + (Polymorphic(std::get<N>(args_).get())).Show() +
+                   ")" +
                    ShowArgs(Number<N + 1>());
         } else {
             return " _" + ShowArgs(Number<N + 1>());
@@ -93,7 +306,7 @@ class ClosureImpl : public ClosureBase {
     F f_;
     args_type args_;
     int filled_args_ = 0;
-    std::string name_;
+    const std::string* name_;
 };
 
 template <class F>
@@ -111,24 +324,51 @@ class SpecialClosureImpl : public ClosureBase {
         return f_(args_);
     }
 
+    Polymorphic GetResultUnchecked() const override { return f_(args_); }
+
     void Apply(const Val& x, Context& ctx) override {
         args_[filled_args_] = std::make_pair(&x, &ctx);
         ++filled_args_;
     }
 
+    void Apply(FlatVal x, Context& ctx) override {
+        args_[filled_args_] =
+            std::make_pair(&x.ast().Materialized(x.index()), &ctx);
+        ++filled_args_;
+    }
+
+    // An argument with placeholders is handed over with their values in
+    // place, in a tree the closure keeps.
+    void Apply(TypedVal x, Context& ctx) override {
+        const Val* arg = &x.val();
+        if (x.has_params()) {
+            bound_.push_back(std::make_shared<const Val>(x.Bound()));
+            arg = bound_.back().get();
+        }
+        args_[filled_args_] = std::make_pair(arg, &ctx);
+        ++filled_args_;
+    }
+
     bool IsTotallyApplied() const override { return filled_args_ == arity_; }
 
-    SpecialClosureImpl(std::string nm, F f)
-        : f_(std::move(f)), filled_args_(0), name_(std::move(nm)) {}
+    // Its arguments are unevaluated trees, which it can't do without.
+    void Own() override {}
+
+    SpecialClosureImpl(const std::string& nm, F f)
+        : f_(std::move(f)), filled_args_(0), name_(&nm) {}
     SpecialClosureImpl(const SpecialClosureImpl&) = default;
+    SpecialClosureImpl(SpecialClosureImpl&&) = default;
 
-    ClosureBase* Copy() const override {
-        return new SpecialClosureImpl<F>(*this);
+    ClosureBase* CopyTo(void* buf) const override {
+        return Box::Place<SpecialClosureImpl>(buf, *this);
+    }
+    ClosureBase* MoveTo(void* buf) override {
+        return Box::Place<SpecialClosureImpl>(buf, std::move(*this));
     }
 
     std::string Show() const override {
         std::ostringstream oss;
-        oss << name_;
+        oss << *name_;
         for (size_t i = 0; i < args_.size(); ++i) {
             if (i < filled_args_) {
                 oss << " (" << Print(*args_[i].first) << ")";
@@ -142,24 +382,32 @@ class SpecialClosureImpl : public ClosureBase {
    private:
     F f_;
     std::array<std::pair<const Val*, Context*>, arity_> args_;
+    std::vector<std::shared_ptr<const Val>> bound_;
     size_t filled_args_;
-    std::string name_;
+    const std::string* name_;
 };
 
 class Closure {
    public:
+    // nm, the name of the function, is shared by its closures: it must outlive
+    // them.
     template <class F>
-    static Closure Get(std::string nm, F&& f) {
-        return Closure(std::make_unique<ClosureImpl<std::decay_t<F>>>(
-            std::move(nm), std::move(f)));
+    static Closure Get(const std::string& nm, F&& f) {
+        Closure c;
+        c.base_.Emplace<ClosureImpl<std::decay_t<F>>>(nm, std::move(f));
+        return c;
     }
     template <class F>
-    static Closure GetSpecial(std::string nm, F&& f) {
-        return Closure(std::make_unique<SpecialClosureImpl<std::decay_t<F>>>(
-            std::move(nm), std::move(f)));
+    static Closure GetSpecial(const std::string& nm, F&& f) {
+        Closure c;
+        c.base_.Emplace<SpecialClosureImpl<std::decay_t<F>>>(nm,
+                                                             std::move(f));
+        return c;
     }
 
     void Apply(const Val& x, Context& ctx) { return base_->Apply(x, ctx); }
+    void Apply(FlatVal x, Context& ctx) { return base_->Apply(x, ctx); }
+    void Apply(TypedVal x, Context& ctx) { return base_->Apply(x, ctx); }
 
     template <class R>
     R GetResult() const {
@@ -168,18 +416,35 @@ class Closure {
 
     Polymorphic GetResult() const { return base_->GetResult(); }
 
+    // Neither the arity nor the type of the result are checked: they have to
+    // be known right, as in an annotated tree.
+    template <class R>
+    R GetResultUnchecked() const {
+        Polymorphic res = base_->GetResultUnchecked();
+        return std::move(res.unchecked_as<R>());
+    }
+
+    Polymorphic GetResultUnchecked() const {
+        return base_->GetResultUnchecked();
+    }
+
     bool IsTotallyApplied() const { return base_->IsTotallyApplied(); }
 
-    Closure(const Closure& c) : base_(c.base_->Copy()) {}
-    Closure(Closure&& c) = default;
+    // For a closure about to be returned out of the evaluation that applied
+    // its arguments: see ArgSlot.
+    void Own() { base_->Own(); }
 
-    Closure& operator=(Closure&&) = default;
+    Closure(const Closure&) = default;
+    Closure(Closure&&) noexcept = default;
+    Closure& operator=(Closure&&) noexcept = default;
 
     std::string Show() const { return base_->Show(); }
 
    private:
-    Closure(std::unique_ptr<ClosureBase> clo) : base_(std::move(clo)) {}
-    std::unique_ptr<ClosureBase> base_;
+    Closure() = default;
+
+    // Most closures live in it rather than on the heap.
+    ClosureBase::Box base_;
 };
 
 }  // namespace slip
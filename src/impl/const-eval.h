@@ -0,0 +1,305 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+namespace slip {
+// A script of the constexpr subset of slip, parsed and type checked by a
+// constexpr constructor. It knows ints, bools, and calls given all their
+// arguments to the arithmetic, comparisons, not, and, or, if, return and
+// const of ImportBase(), for which it gives the same results as Eval(). The
+// text is parsed like ParseRD() does.
+//
+// Errors throw: evaluated at compile time, that fails the build. N bounds the
+// number of nodes, so the length of the text is enough.
+template <size_t N>
+class ConstScript {
+   public:
+    enum class Kind : uint8_t { Int, Bool, Atom, List };
+
+    constexpr ConstScript(const char* text, size_t size) {
+        const char* cur = text;
+        const char* end = text + size;
+        if (cur == end || *cur != '(') {
+            throw std::runtime_error("parse error");
+        }
+        ++cur;
+        // The lists not closed yet, like the frames of ValBuilder.
+        uint32_t open[N] = {};
+        size_t depth = 0;
+        open[depth++] = Push(Kind::List, Op::None, 0);
+        while (depth) {
+            while (cur != end && (*cur == ' ' || *cur == '\t')) {
+                ++cur;
+            }
+            if (cur == end) {
+                throw std::runtime_error("parse error");
+            }
+            if (*cur == '(') {
+                ++cur;
+                open[depth++] = Push(Kind::List, Op::None, 0);
+            } else if (*cur == ')') {
+                ++cur;
+                nodes_[open[--depth]].end = size_;
+            } else {
+                cur = ParseValue(cur, end);
+            }
+        }
+        type_ = TypeOf(0);
+    }
+
+    // Int or Bool.
+    constexpr Kind type() const { return type_; }
+
+    template <class T>
+    constexpr T Eval() const {
+        static_assert(std::is_same<T, int>::value ||
+                          std::is_same<T, bool>::value,
+                      "constexpr scripts evaluate to int or bool");
+        if (type_ != (std::is_same<T, int>::value ? Kind::Int : Kind::Bool)) {
+            throw std::runtime_error(
+                std::string("can't evaluate an expression of type ") +
+                (type_ == Kind::Int ? "Int" : "Bool"));
+        }
+        return static_cast<T>(EvalNode(0));
+    }
+
+   private:
+    enum class Op : uint8_t {
+        Add,
+        Sub,
+        Mul,
+        Div,
+        Mod,
+        Eq,
+        Le,
+        Ge,
+        Lt,
+        Gt,
+        Not,
+        And,
+        Or,
+        If,
+        Return,
+        Const,
+        None
+    };
+
+    struct Node {
+        Kind kind = Kind::Int;
+        // Atom: the function it names.
+        Op op = Op::None;
+        // Int and Bool: the value.
+        int value = 0;
+        // One past the last node of this subtree, in preorder.
+        uint32_t end = 0;
+    };
+
+    constexpr uint32_t Push(Kind kind, Op op, int value) {
+        nodes_[size_] = Node{kind, op, value, size_ + 1};
+        return size_++;
+    }
+
+    static constexpr bool StartsWith(const char* cur,
+                                     const char* end,
+                                     const char* word) {
+        for (; *word; ++cur, ++word) {
+            if (cur == end || *cur != *word) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static constexpr bool Equal(const char* begin,
+                                const char* end,
+                                const char* word) {
+        for (; begin != end; ++begin, ++word) {
+            if (*begin != *word) {
+                return false;
+            }
+        }
+        return !*word;
+    }
+
+    static constexpr bool IsAtomEnd(char c) {
+        return c == ' ' || (c >= '\t' && c <= '\r') || c == '(' || c == ')';
+    }
+
+    static constexpr Op Lookup(const char* begin, const char* end) {
+        const char* const names[] = {"+", "-", "*", "/", "%", "==",
+                                     "<=", ">=", "<", ">", "not", "and",
+                                     "or", "if", "return", "const"};
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+            if (Equal(begin, end, names[i])) {
+                return static_cast<Op>(i);
+            }
+        }
+        throw std::runtime_error("Can't find function " +
+                                 std::string(begin, end));
+    }
+
+    constexpr const char* ParseValue(const char* cur, const char* end) {
+        if (*cur >= '0' && *cur <= '9') {
+            unsigned acc = 0;
+            for (; cur != end && *cur >= '0' && *cur <= '9'; ++cur) {
+                acc = acc * 10 + (*cur - '0');
+            }
+            Push(Kind::Int, Op::None, static_cast<int>(acc));
+            return cur;
+        }
+        if (*cur == '"') {
+            for (const char* c = cur + 1; c != end; ++c) {
+                if (*c == '"') {
+                    throw std::runtime_error("strings aren't constexpr");
+                }
+            }
+        } else if (StartsWith(cur, end, "true")) {
+            Push(Kind::Bool, Op::None, 1);
+            return cur + 4;
+        } else if (StartsWith(cur, end, "false")) {
+            Push(Kind::Bool, Op::None, 0);
+            return cur + 5;
+        }
+        const char* atom_end = cur;
+        while (atom_end != end && !IsAtomEnd(*atom_end)) {
+            ++atom_end;
+        }
+        if (atom_end == cur) {
+            throw std::runtime_error("parse error");
+        }
+        Push(Kind::Atom, Lookup(cur, atom_end), 0);
+        return atom_end;
+    }
+
+    static constexpr size_t Arity(Op op) {
+        return op == Op::Not || op == Op::Return ? 1 : op == Op::If ? 3 : 2;
+    }
+
+    // Checks the whole subtree, branches of if not taken included, like
+    // TypeCheck() does.
+    constexpr Kind TypeOf(uint32_t i) const {
+        const Node& x = nodes_[i];
+        if (x.kind == Kind::Int || x.kind == Kind::Bool) {
+            return x.kind;
+        }
+        if (x.kind == Kind::Atom) {
+            throw std::runtime_error("functions aren't constexpr values");
+        }
+        uint32_t head = i + 1;
+        if (head == x.end || nodes_[head].kind != Kind::Atom) {
+            throw std::runtime_error("only named functions are constexpr");
+        }
+        Op op = nodes_[head].op;
+        Kind args[3] = {};
+        size_t arity = 0;
+        for (uint32_t arg = nodes_[head].end; arg != x.end;
+             arg = nodes_[arg].end) {
+            if (arity == Arity(op)) {
+                throw std::runtime_error("too many arguments");
+            }
+            args[arity++] = TypeOf(arg);
+        }
+        if (arity != Arity(op)) {
+            throw std::runtime_error("partial application isn't constexpr");
+        }
+        switch (op) {
+            case Op::If:
+                if (args[0] != Kind::Bool || args[1] != args[2]) {
+                    throw std::runtime_error("if of mismatched types");
+                }
+                return args[1];
+            case Op::Return:
+            case Op::Const:
+                return args[0];
+            case Op::Not:
+            case Op::And:
+            case Op::Or:
+                for (size_t a = 0; a < arity; ++a) {
+                    if (args[a] != Kind::Bool) {
+                        throw std::runtime_error("Bool expected");
+                    }
+                }
+                return Kind::Bool;
+            default:
+                if (args[0] != Kind::Int || args[1] != Kind::Int) {
+                    throw std::runtime_error("Int expected");
+                }
+                return op < Op::Eq ? Kind::Int : Kind::Bool;
+        }
+    }
+
+    // Bools are 0 or 1.
+    constexpr int EvalNode(uint32_t i) const {
+        const Node& x = nodes_[i];
+        if (x.kind != Kind::List) {
+            return x.value;
+        }
+        uint32_t head = i + 1;
+        Op op = nodes_[head].op;
+        uint32_t first = nodes_[head].end;
+        if (op == Op::If) {
+            uint32_t then = nodes_[first].end;
+            return EvalNode(first) ? EvalNode(then)
+                                   : EvalNode(nodes_[then].end);
+        }
+        // Like those of functions, all arguments are evaluated.
+        int args[2] = {};
+        size_t arity = 0;
+        for (uint32_t arg = first; arg != x.end; arg = nodes_[arg].end) {
+            args[arity++] = EvalNode(arg);
+        }
+        int a = args[0];
+        int b = args[1];
+        switch (op) {
+            case Op::Add:
+                return a + b;
+            case Op::Sub:
+                return a - b;
+            case Op::Mul:
+                return a * b;
+            case Op::Div:
+            case Op::Mod:
+                if (!b) {
+                    throw std::runtime_error("division by zero");
+                }
+                return op == Op::Div ? a / b : a % b;
+            case Op::Eq:
+                return a == b;
+            case Op::Le:
+                return a <= b;
+            case Op::Ge:
+                return a >= b;
+            case Op::Lt:
+                return a < b;
+            case Op::Gt:
+                return a > b;
+            case Op::Not:
+                return !a;
+            case Op::And:
+                return a && b;
+            case Op::Or:
+                return a || b;
+            default:
+                return a;
+        }
+    }
+
+    Node nodes_[N] = {};
+    uint32_t size_ = 0;
+    Kind type_ = Kind::Int;
+};
+
+// Evaluates a literal script, at compile time when the result is needed
+// there:
+//
+//   static_assert(ConstEval<int>("(+ 1 (* 2 3))") == 7, "");
+//   constexpr bool kVerbose = ConstEval<bool>("(< 3 (% 10 4))");
+template <class T, size_t N>
+constexpr T ConstEval(const char (&script)[N]) {
+    return ConstScript<N>(script, N - 1).template Eval<T>();
+}
+}  // namespace slip
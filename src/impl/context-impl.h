@@ -1,66 +1,106 @@
 #pragma once
 
+#include <algorithm>
+
 #include "context.h"
 #include "eval.h"
 #include "polymorphic.h"
 
 namespace slip {
 template <class F>
-void Context::DeclareFun(std::string name, F&& f) {
-    auto ptr = std::unique_ptr<Function>(
-        new NormalFunc<F>(std::move(name), std::move(f)));
-    functions_[ptr->mangled_name()] = std::move(ptr);
+Function* Context::DeclareFun(std::string name, F&& f) {
+    return Add(std::unique_ptr<Function>(
+        new NormalFunc<F>(std::move(name), std::move(f))));
 }
 
 template <class F>
-void Context::DeclareFun(std::string name, std::string type, F&& f) {
-    auto ptr = std::unique_ptr<Function>(
-        new NormalFunc<F>(std::move(name), std::move(type), std::move(f)));
-    functions_[ptr->mangled_name()] = std::move(ptr);
+Function* Context::DeclareFun(std::string name, std::string type, F&& f) {
+    return Add(std::unique_ptr<Function>(
+        new NormalFunc<F>(std::move(name), std::move(type), std::move(f))));
 }
 
 template <class F>
-void Context::DeclareSpecial(std::string name, std::string ty, F&& f) {
-    auto ptr = std::unique_ptr<Function>(
-        new SpecialFun<F>(std::move(name), std::move(ty), std::move(f)));
-    functions_[ptr->mangled_name()] = std::move(ptr);
+Function* Context::DeclareSpecial(std::string name, std::string ty, F&& f) {
+    return Add(std::unique_ptr<Function>(
+        new SpecialFun<F>(std::move(name), std::move(ty), std::move(f))));
 }
 
-Function* Context::Find(const std::string& name) const {
-    auto found = functions_.find(name);
-    if (found != functions_.end()) {
-        return found->second.get();
+Function* Context::Add(std::unique_ptr<Function> fun) {
+    size_t sym = symbols().Intern(fun->mangled_name());
+    if (sym >= functions_.size()) {
+        functions_.resize(sym + 1);
+    }
+    // Declaring a type again replaces its function, another type adds an
+    // overload. What was replaced is kept: trees, closures and scripts may
+    // still point to it.
+    auto& overloads = functions_[sym];
+    auto same = std::find_if(overloads.begin(),
+                             overloads.end(),
+                             [&](const std::unique_ptr<Function>& f) {
+                                 return f->type().type() == fun->type().type();
+                             });
+    if (same != overloads.end()) {
+        retired_.push_back(std::move(*same));
+        *same = std::move(fun);
+    } else {
+        overloads.push_back(std::move(fun));
+        same = overloads.end() - 1;
     }
-    return nullptr;
+    type_cache_.Clear();
+    stamp_ = NewStamp();
+    return same->get();
+}
+
+Function* Context::Find(const std::string& name) const {
+    return Find(symbols().Find(name));
 }
 
 void Context::Dump() const {
-    for (auto& x : functions_) {
-        std::cout << x.second->mangled_name()
-                  << " :: " << x.second->type().Show() << "\n";
+    for (auto& overloads : functions_) {
+        for (auto& x : overloads) {
+            std::cout << x->mangled_name() << " :: " << x->type().Show()
+                      << "\n";
+        }
     }
 }
 
 void Context::ImportBase() {
-    DeclareFun("+", [](int a, int b) -> int { return a + b; });
+    DeclareFun("+", [](int a, int b) -> int { return a + b; })
+        ->set_intrinsic(Intrinsic::Add);
+    DeclareFun("+",
+               [](const std::string& a, const std::string& b) -> std::string {
+                   return a + b;
+               });
     DeclareFun("+s",
                [](const std::string& a, const std::string& b) -> std::string {
                    return a + b;
                });
-    DeclareFun("*", [](int a, int b) -> int { return a * b; });
-    DeclareFun("-", [](int a, int b) -> int { return a - b; });
-    DeclareFun("%", [](int a, int b) -> int { return a % b; });
-    DeclareFun("/", [](int a, int b) -> int { return a / b; });
+    DeclareFun("*", [](int a, int b) -> int { return a * b; })
+        ->set_intrinsic(Intrinsic::Mul);
+    DeclareFun("-", [](int a, int b) -> int { return a - b; })
+        ->set_intrinsic(Intrinsic::Sub);
+    DeclareFun("%", [](int a, int b) -> int { return a % b; })
+        ->set_intrinsic(Intrinsic::Mod);
+    DeclareFun("/", [](int a, int b) -> int { return a / b; })
+        ->set_intrinsic(Intrinsic::Div);
 
-    DeclareFun("==", [](int a, int b) -> bool { return a == b; });
-    DeclareFun("<=", [](int a, int b) -> bool { return a <= b; });
-    DeclareFun(">=", [](int a, int b) -> bool { return a >= b; });
-    DeclareFun("<", [](int a, int b) -> bool { return a < b; });
-    DeclareFun(">", [](int a, int b) -> bool { return a > b; });
+    DeclareFun("==", [](int a, int b) -> bool { return a == b; })
+        ->set_intrinsic(Intrinsic::Eq);
+    DeclareFun("<=", [](int a, int b) -> bool { return a <= b; })
+        ->set_intrinsic(Intrinsic::Le);
+    DeclareFun(">=", [](int a, int b) -> bool { return a >= b; })
+        ->set_intrinsic(Intrinsic::Ge);
+    DeclareFun("<", [](int a, int b) -> bool { return a < b; })
+        ->set_intrinsic(Intrinsic::Lt);
+    DeclareFun(">", [](int a, int b) -> bool { return a > b; })
+        ->set_intrinsic(Intrinsic::Gt);
 
-    DeclareFun("not", [](bool a) -> bool { return !a; });
-    DeclareFun("and", [](bool a, bool b) -> bool { return a && b; });
-    DeclareFun("or", [](bool a, bool b) -> bool { return a || b; });
+    DeclareFun("not", [](bool a) -> bool { return !a; })
+        ->set_intrinsic(Intrinsic::Not);
+    DeclareFun("and", [](bool a, bool b) -> bool { return a && b; })
+        ->set_intrinsic(Intrinsic::And);
+    DeclareFun("or", [](bool a, bool b) -> bool { return a || b; })
+        ->set_intrinsic(Intrinsic::Or);
 
     DeclareSpecial(
         "if",
@@ -69,11 +109,14 @@ void Context::ImportBase() {
             return Eval<bool>(*args[0].first, *args[0].second)
                        ? Eval<Polymorphic>(*args[1].first, *args[1].second)
                        : Eval<Polymorphic>(*args[2].first, *args[2].second);
-        });
+        })
+        ->set_intrinsic(Intrinsic::If);
 
-    DeclareFun("return", "a -> a", [](const Polymorphic& x) { return x; });
+    DeclareFun("return", "a -> a", [](const Polymorphic& x) { return x; })
+        ->set_intrinsic(Intrinsic::Return);
     DeclareFun("const",
                "a -> b -> a",
-               [](const Polymorphic& a, const Polymorphic&) { return a; });
+               [](const Polymorphic& a, const Polymorphic&) { return a; })
+        ->set_intrinsic(Intrinsic::Const);
 }
 }  // namespace slip
@@ -1,12 +1,16 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <iostream>
-#include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "function.h"
 #include "mangler.h"
+#include "symbol.h"
+#include "type-cache.h"
 
 namespace slip {
 class Context {
@@ -14,22 +18,63 @@ class Context {
     Context() = default;
     Context(const Context&) = delete;
 
+    // Each returns the function declared.
     template <class F>
-    void DeclareFun(std::string name, F&& f);
+    Function* DeclareFun(std::string name, F&& f);
 
     template <class F>
-    void DeclareFun(std::string name, std::string type, F&& f);
+    Function* DeclareFun(std::string name, std::string type, F&& f);
 
     template <class F>
-    void DeclareSpecial(std::string name, std::string ty, F&& f);
+    Function* DeclareSpecial(std::string name, std::string ty, F&& f);
 
+    // The first function declared under that name.
     Function* Find(const std::string& name) const;
+    Function* Find(int symbol) const { return Find(symbol, 0); }
+    Function* Find(int symbol, int overload) const {
+        const auto& overloads = Overloads(symbol);
+        if (static_cast<size_t>(overload) >= overloads.size()) {
+            return nullptr;
+        }
+        return overloads[overload].get();
+    }
+
+    // Functions declared under the name of symbol, one per type, in order of
+    // declaration.
+    const std::vector<std::unique_ptr<Function>>& Overloads(int symbol) const {
+        static const std::vector<std::unique_ptr<Function>> none;
+        if (symbol < 0 || symbol >= static_cast<int>(functions_.size())) {
+            return none;
+        }
+        return functions_[symbol];
+    }
+
+    SymbolTable& symbols() const { return SymbolTable::Global(); }
+
+    // Cleared whenever a function is declared.
+    TypeCache& type_cache() { return type_cache_; }
+
+    // Changes whenever a function is declared, and is never that of another
+    // Context: what was linked with another stamp may be stale.
+    uint64_t stamp() const { return stamp_; }
 
     void Dump() const;
 
     void ImportBase();
 
    private:
-    std::map<std::string, std::unique_ptr<Function>> functions_;
+    Function* Add(std::unique_ptr<Function> fun);
+
+    static uint64_t NewStamp() {
+        static std::atomic<uint64_t> last(0);
+        return ++last;
+    }
+
+    // Indexed by the symbol of their name, then by overload.
+    std::vector<std::vector<std::unique_ptr<Function>>> functions_;
+    // Replaced by a declaration of the same name and type.
+    std::vector<std::unique_ptr<Function>> retired_;
+    TypeCache type_cache_;
+    uint64_t stamp_ = NewStamp();
 };
 }  // namespace slip
@@ -7,6 +7,7 @@
 #include "closure.h"
 #include "context.h"
 #include "polymorphic.h"
+#include "typed-ast.h"
 
 namespace slip {
 void ApplyOnArgs(Closure& fun, const List& xs, Context& ctx) {
@@ -37,10 +38,12 @@ T Eval(const Val& x, Context& ctx) {
 template <>
 Closure Eval<Closure>(const Val& x, Context& ctx) {
     if (const Atom* i = boost::get<Atom>(&x)) {
-        std::string funname = Eval<std::string>(*i, ctx);
-        auto fun = ctx.Find(funname);
+        Function* fun = i->function(ctx.stamp());
         if (!fun) {
-            throw std::runtime_error("no such function: " + funname);
+            fun = ctx.Find(i->symbol(), i->overload());
+        }
+        if (!fun) {
+            throw std::runtime_error("no such function: " + i->val());
         }
         return fun->GetClosure();
     } else if (const List* l = boost::get<List>(&x)) {
@@ -48,9 +51,9 @@ Closure Eval<Closure>(const Val& x, Context& ctx) {
         ApplyOnArgs(fun, *l, ctx);
         if (fun.IsTotallyApplied()) {
             return fun.GetResult<Closure>();
-        } else {
-            return fun;
         }
+        fun.Own();
+        return fun;
     }
     throw std::runtime_error("Expected a closure");
 }
@@ -118,11 +121,256 @@ Polymorphic Eval<Polymorphic>(const Val& v, Context& ctx) {
             ApplyOnArgs(fun, i, ctx_);
             if (fun.IsTotallyApplied()) {
                 return fun.GetResult();
-            } else {
-                return Polymorphic(std::move(fun));
             }
+            fun.Own();
+            return Polymorphic(std::move(fun));
         }
     } vis(ctx);
     return boost::apply_visitor(vis, v);
 }
+
+void ApplyOnArgs(Closure& fun, FlatVal xs, Context& ctx) {
+    auto it = xs.begin();
+    for (++it; it != xs.end(); ++it) {
+        if (fun.IsTotallyApplied()) {
+            fun = fun.GetResult<Closure>();
+        }
+        fun.Apply(*it, ctx);
+    }
+}
+
+template <class T>
+T Eval(FlatVal x, Context& ctx) {
+    if (x.kind() == FlatVal::Kind::List) {
+        Closure fun = Eval<Closure>(x[0], ctx);
+        ApplyOnArgs(fun, x, ctx);
+        return fun.GetResult<T>();
+    }
+    throw std::runtime_error("expected a " + GetTypeId<T>::type() +
+                             " expression");
+}
+
+template <>
+Closure Eval<Closure>(FlatVal x, Context& ctx) {
+    if (x.kind() == FlatVal::Kind::Atom) {
+        auto fun = ctx.Find(x.symbol(), x.overload());
+        if (!fun) {
+            throw std::runtime_error("no such function: " + x.str());
+        }
+        return fun->GetClosure();
+    } else if (x.kind() == FlatVal::Kind::List) {
+        Closure fun = Eval<Closure>(x[0], ctx);
+        ApplyOnArgs(fun, x, ctx);
+        if (fun.IsTotallyApplied()) {
+            return fun.GetResult<Closure>();
+        }
+        fun.Own();
+        return fun;
+    }
+    throw std::runtime_error("Expected a closure");
+}
+
+template <>
+std::string Eval<std::string>(FlatVal v, Context& ctx) {
+    switch (v.kind()) {
+        case FlatVal::Kind::Atom:
+        case FlatVal::Kind::Str:
+            return v.str();
+        case FlatVal::Kind::List: {
+            Closure fun = Eval<Closure>(v[0], ctx);
+            ApplyOnArgs(fun, v, ctx);
+            return fun.GetResult<std::string>();
+        }
+        default:
+            throw std::runtime_error("expected a str expression");
+    }
+}
+
+template <>
+int Eval<int>(FlatVal v, Context& ctx) {
+    if (v.kind() == FlatVal::Kind::Int) {
+        return v.int_val();
+    } else if (v.kind() == FlatVal::Kind::List) {
+        Closure fun = Eval<Closure>(v[0], ctx);
+        ApplyOnArgs(fun, v, ctx);
+        return fun.GetResult<int>();
+    }
+    throw std::runtime_error("expected an int expression");
+}
+
+template <>
+bool Eval<bool>(FlatVal v, Context& ctx) {
+    if (v.kind() == FlatVal::Kind::Bool) {
+        return v.bool_val();
+    } else if (v.kind() == FlatVal::Kind::List) {
+        Closure fun = Eval<Closure>(v[0], ctx);
+        ApplyOnArgs(fun, v, ctx);
+        return fun.GetResult<bool>();
+    }
+    throw std::runtime_error("expected a bool expression");
+}
+
+template <>
+Polymorphic Eval<Polymorphic>(FlatVal v, Context& ctx) {
+    switch (v.kind()) {
+        case FlatVal::Kind::Int:
+            return v.int_val();
+        case FlatVal::Kind::Bool:
+            return v.bool_val();
+        case FlatVal::Kind::Atom:
+        case FlatVal::Kind::Str:
+            return v.str();
+        case FlatVal::Kind::List:
+            break;
+    }
+    Closure fun = Eval<Closure>(v[0], ctx);
+    ApplyOnArgs(fun, v, ctx);
+    if (fun.IsTotallyApplied()) {
+        return fun.GetResult();
+    }
+    fun.Own();
+    return Polymorphic(std::move(fun));
+}
+
+// An annotated tree is evaluated trusting its annotations: calls go straight
+// to the function found by the checker, literals aren't probed, and results
+// of complete calls are taken without checking their arity nor their type.
+
+// Applies the arguments of a call, and returns whether the closure ends up
+// totally applied. When the head names a function, how many arguments its
+// closure takes is known, so only arguments beyond those, which go to the
+// closure it returns, need checking.
+bool ApplyOnArgs(Closure& fun, TypedVal xs, Context& ctx) {
+    auto it = xs.begin();
+    ++it;
+    int args = xs.size() - 1;
+    if (xs.arity() >= 0 && args <= xs.arity()) {
+        for (; it != xs.end(); ++it) {
+            fun.Apply(*it, ctx);
+        }
+        return args == xs.arity();
+    }
+    for (; it != xs.end(); ++it) {
+        if (fun.IsTotallyApplied()) {
+            fun = fun.GetResult<Closure>();
+        }
+        fun.Apply(*it, ctx);
+    }
+    return fun.IsTotallyApplied();
+}
+
+template <class T>
+T Eval(TypedVal x, Context& ctx) {
+    Closure fun = Eval<Closure>(x.head(), ctx);
+    ApplyOnArgs(fun, x, ctx);
+    return fun.GetResultUnchecked<T>();
+}
+
+template <>
+Closure Eval<Closure>(TypedVal x, Context& ctx) {
+    if (x.kind() == TypedVal::Kind::Atom) {
+        return x.function()->GetClosure();
+    }
+    Closure fun = Eval<Closure>(x.head(), ctx);
+    if (ApplyOnArgs(fun, x, ctx)) {
+        return fun.GetResultUnchecked<Closure>();
+    }
+    fun.Own();
+    return fun;
+}
+
+template <>
+std::string Eval<std::string>(TypedVal x, Context& ctx) {
+    if (x.kind() == TypedVal::Kind::Str) {
+        return boost::get<Str>(x.val()).val();
+    }
+    if (x.kind() == TypedVal::Kind::Param) {
+        return x.param().unchecked_as<std::string>();
+    }
+    Closure fun = Eval<Closure>(x.head(), ctx);
+    ApplyOnArgs(fun, x, ctx);
+    return fun.GetResultUnchecked<std::string>();
+}
+
+template <>
+int Eval<int>(TypedVal x, Context& ctx) {
+    if (x.kind() == TypedVal::Kind::Int) {
+        return x.int_val();
+    }
+    if (x.kind() == TypedVal::Kind::Param) {
+        return x.param().unchecked_as<int>();
+    }
+    Closure fun = Eval<Closure>(x.head(), ctx);
+    ApplyOnArgs(fun, x, ctx);
+    return fun.GetResultUnchecked<int>();
+}
+
+template <>
+bool Eval<bool>(TypedVal x, Context& ctx) {
+    if (x.kind() == TypedVal::Kind::Bool) {
+        return x.bool_val();
+    }
+    if (x.kind() == TypedVal::Kind::Param) {
+        return x.param().unchecked_as<bool>();
+    }
+    Closure fun = Eval<Closure>(x.head(), ctx);
+    ApplyOnArgs(fun, x, ctx);
+    return fun.GetResultUnchecked<bool>();
+}
+
+template <>
+Polymorphic Eval<Polymorphic>(TypedVal x, Context& ctx) {
+    switch (x.kind()) {
+        case TypedVal::Kind::Int:
+            return x.int_val();
+        case TypedVal::Kind::Bool:
+            return x.bool_val();
+        case TypedVal::Kind::Str:
+            return boost::get<Str>(x.val()).val();
+        case TypedVal::Kind::Atom:
+            return Polymorphic(x.function()->GetClosure());
+        case TypedVal::Kind::Param:
+            return x.param();
+        case TypedVal::Kind::List:
+            break;
+    }
+    if (x.empty()) {
+        return Polymorphic();
+    }
+    Closure fun = Eval<Closure>(x.head(), ctx);
+    if (ApplyOnArgs(fun, x, ctx)) {
+        return fun.GetResultUnchecked();
+    }
+    fun.Own();
+    return Polymorphic(std::move(fun));
+}
+
+namespace {
+// Whether an expression of type ty evaluates to a T.
+template <class T>
+struct EvaluatesTo {
+    static bool Check(Type ty) { return ty == TypeOf<T>(); }
+};
+
+template <>
+struct EvaluatesTo<Polymorphic> {
+    static bool Check(Type) { return true; }
+};
+
+template <>
+struct EvaluatesTo<Closure> {
+    static bool Check(Type ty) { return ty.is_arrow(); }
+};
+}  // namespace
+
+// Only the type of the root is checked, against T.
+template <class T>
+T Eval(const TypedAst& ast, Context& ctx) {
+    TypedVal root = ast.root();
+    if (!EvaluatesTo<T>::Check(root.type())) {
+        throw std::runtime_error("can't evaluate an expression of type " +
+                                 Prototype(root.type()).Show());
+    }
+    return Eval<T>(root, ctx);
+}
 }  // namespace slip
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ast.h"
+#include "rd-parser.h"
+
+namespace slip {
+class FlatVal;
+
+// A script stored as one contiguous array of fixed size nodes in preorder,
+// plus one buffer for the text of its strings. Children of a list
+// directly follow it, and every node knows where its subtree ends, which is
+// where its next sibling starts. Dropping the tree is two frees, whatever its
+// size.
+class FlatAst {
+   public:
+    enum class Kind : uint8_t { Int, Bool, Atom, Str, List };
+
+    struct Node {
+        Kind kind;
+        // Int and Bool: the value. Atom: its symbol. Str: offset in text_.
+        int32_t value;
+        // Str: length of the text. List: number of children. Atom: the
+        // overload it is bound to, see Atom::overload().
+        uint32_t size;
+        // One past the last node of this subtree.
+        uint32_t end;
+    };
+
+    FlatAst() = default;
+    // The materialized subtrees go along, not the lock.
+    FlatAst(FlatAst&& o) noexcept
+        : nodes_(std::move(o.nodes_)),
+          text_(std::move(o.text_)),
+          materialized_(std::move(o.materialized_)) {}
+    FlatAst& operator=(FlatAst&& o) noexcept {
+        nodes_ = std::move(o.nodes_);
+        text_ = std::move(o.text_);
+        materialized_ = std::move(o.materialized_);
+        return *this;
+    }
+
+    FlatVal root() const;
+
+    size_t node_count() const { return nodes_.size(); }
+    const Node& node(uint32_t i) const { return nodes_[i]; }
+    const char* text(uint32_t i) const { return &text_[nodes_[i].value]; }
+
+    // Special functions receive their arguments as const Val*, so those
+    // subtrees are converted once and kept for the lifetime of the tree.
+    // Type checking materializes the arguments of the special calls it
+    // finds, or binds them again to their overloads if they already were.
+    // Evaluation only looks them up, under a lock for the few it didn't, so
+    // that several threads may evaluate the same tree. Like Bind(),
+    // Materialize() must not run while the tree is evaluated.
+    const Val& Materialized(uint32_t i) const;
+    void Materialize(uint32_t i) const;
+
+    // Binds the atom i to an overload, as type checking does.
+    void Bind(uint32_t i, int overload) const { nodes_[i].size = overload; }
+
+    size_t allocated_bytes() const {
+        return nodes_.capacity() * sizeof(Node) + text_.capacity();
+    }
+
+   private:
+    friend class FlatBuilder;
+
+    // Binds the atoms of val, materialized from x, to the overloads of x.
+    static void Rebind(FlatVal x, const Val& val);
+
+    mutable std::vector<Node> nodes_;
+    std::string text_;
+    mutable std::unordered_map<uint32_t, std::unique_ptr<Val>> materialized_;
+    mutable std::mutex materialized_mutex_;
+};
+
+// A node of a FlatAst, cheap to copy around.
+class FlatVal {
+   public:
+    using Kind = FlatAst::Kind;
+
+    class iterator {
+       public:
+        iterator(const FlatAst* ast, uint32_t idx) : ast_(ast), idx_(idx) {}
+        FlatVal operator*() const { return FlatVal(ast_, idx_); }
+        iterator& operator++() {
+            idx_ = ast_->node(idx_).end;
+            return *this;
+        }
+        bool operator!=(const iterator& o) const { return idx_ != o.idx_; }
+
+       private:
+        const FlatAst* ast_;
+        uint32_t idx_;
+    };
+
+    FlatVal(const FlatAst* ast, uint32_t idx) : ast_(ast), idx_(idx) {}
+
+    Kind kind() const { return node().kind; }
+    int int_val() const { return node().value; }
+    bool bool_val() const { return node().value; }
+    int symbol() const { return node().value; }
+    int overload() const { return node().size; }
+    void Bind(int overload) const { ast_->Bind(idx_, overload); }
+    std::string str() const { return view().to_string(); }
+    // Atom and Str: the text, which lives as long as the tree.
+    boost::string_view view() const {
+        if (kind() == Kind::Atom) {
+            return SymbolTable::Global().Name(symbol());
+        }
+        return boost::string_view(ast_->text(idx_), node().size);
+    }
+
+    // List accessors.
+    bool empty() const { return node().size == 0; }
+    size_t size() const { return node().size; }
+    iterator begin() const { return iterator(ast_, idx_ + 1); }
+    iterator end() const { return iterator(ast_, node().end); }
+    FlatVal operator[](size_t i) const {
+        auto it = begin();
+        while (i--) {
+            ++it;
+        }
+        return *it;
+    }
+
+    const FlatAst& ast() const { return *ast_; }
+    uint32_t index() const { return idx_; }
+
+    Val ToVal() const;
+
+   private:
+    const FlatAst::Node& node() const { return ast_->node(idx_); }
+
+    const FlatAst* ast_;
+    uint32_t idx_;
+};
+
+// Fills a FlatAst from the tokens of RDParser.
+class FlatBuilder {
+   public:
+    explicit FlatBuilder(FlatAst& ast) : ast_(ast) {}
+
+    void OpenList() {
+        if (!frames_.empty()) {
+            ++ast_.nodes_[frames_.back()].size;
+        }
+        frames_.push_back(ast_.nodes_.size());
+        ast_.nodes_.push_back({FlatAst::Kind::List, 0, 0, 0});
+    }
+
+    void CloseList() {
+        ast_.nodes_[frames_.back()].end = ast_.nodes_.size();
+        frames_.pop_back();
+    }
+
+    void AddInt(int i) { AddLeaf(FlatAst::Kind::Int, i, 0); }
+    void AddBool(bool b) { AddLeaf(FlatAst::Kind::Bool, b, 0); }
+    void AddStr(const char* b, const char* e) {
+        AddLeaf(FlatAst::Kind::Str, AddText(b, e), e - b);
+    }
+    void AddAtom(const char* b, const char* e) {
+        AddLeaf(FlatAst::Kind::Atom, Atom(b, e).symbol(), 0);
+    }
+    void AddSymbol(int symbol) { AddLeaf(FlatAst::Kind::Atom, symbol, 0); }
+
+   private:
+    int32_t AddText(const char* b, const char* e) {
+        int32_t offset = ast_.text_.size();
+        ast_.text_.append(b, e);
+        return offset;
+    }
+
+    void AddLeaf(FlatAst::Kind kind, int32_t value, uint32_t size) {
+        if (!frames_.empty()) {
+            ++ast_.nodes_[frames_.back()].size;
+        }
+        uint32_t idx = ast_.nodes_.size();
+        ast_.nodes_.push_back({kind, value, size, idx + 1});
+    }
+
+    FlatAst& ast_;
+    std::vector<uint32_t> frames_;
+};
+
+FlatVal FlatAst::root() const { return FlatVal(this, 0); }
+
+Val FlatVal::ToVal() const {
+    switch (kind()) {
+        case Kind::Int:
+            return Int(int_val());
+        case Kind::Bool:
+            return Bool(bool_val());
+        case Kind::Atom: {
+            Atom atom = Atom::FromSymbol(symbol());
+            atom.Bind(overload());
+            return atom;
+        }
+        case Kind::Str:
+            return Str(str());
+        case Kind::List: {
+            std::vector<Val> vals;
+            vals.reserve(size());
+            for (FlatVal x : *this) {
+                vals.push_back(x.ToVal());
+            }
+            return List(std::move(vals));
+        }
+    }
+    throw std::runtime_error("corrupted flat ast");
+}
+
+const Val& FlatAst::Materialized(uint32_t i) const {
+    std::lock_guard<std::mutex> lock(materialized_mutex_);
+    auto& val = materialized_[i];
+    if (!val) {
+        val = std::make_unique<Val>(FlatVal(this, i).ToVal());
+    }
+    return *val;
+}
+
+void FlatAst::Materialize(uint32_t i) const {
+    std::lock_guard<std::mutex> lock(materialized_mutex_);
+    auto& val = materialized_[i];
+    if (val) {
+        // Closures may still point to it: it is updated rather than replaced.
+        Rebind(FlatVal(this, i), *val);
+    } else {
+        val = std::make_unique<Val>(FlatVal(this, i).ToVal());
+    }
+}
+
+void FlatAst::Rebind(FlatVal x, const Val& val) {
+    if (x.kind() == Kind::Atom) {
+        const Atom& atom = boost::get<Atom>(val);
+        if (atom.overload() != x.overload()) {
+            atom.Bind(x.overload());
+        }
+    } else if (x.kind() == Kind::List) {
+        const List& vals = boost::get<List>(val);
+        size_t i = 0;
+        for (FlatVal child : x) {
+            Rebind(child, vals[i++]);
+        }
+    }
+}
+
+// Same grammar and same acceptance as Parse(), but into a FlatAst.
+ParserRet<FlatAst> ParseFlat(boost::string_view input) {
+    FlatAst ast;
+    FlatBuilder builder(ast);
+    RDParser<FlatBuilder> parser(
+        input.data(), input.data() + input.size(), builder);
+    if (!parser.ParseExpr()) {
+        return ParserRet<FlatAst>();
+    }
+    return make_optional(std::make_pair(std::move(ast), parser.pos()));
+}
+}  // namespace slip
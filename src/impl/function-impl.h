@@ -10,7 +10,7 @@ namespace slip {
 
 template <class F>
 NormalFunc<F>::NormalFunc(std::string name, F&& f)
-    : Function(name, ManglerCaller<std::decay_t<F>>::Mangle()),
+    : Function(name, ManglerCaller<std::decay_t<F>>::Signature()),
       fun_(std::move(f)) {}
 
 template <class F>
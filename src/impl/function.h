@@ -1,7 +1,10 @@
 #pragma once
 
 #include <functional>
+#include <stdexcept>
 #include <string>
+#include <tuple>
+#include <utility>
 
 #include "ast.h"
 #include "closure.h"
@@ -11,6 +14,78 @@
 
 namespace slip {
 class Context;
+
+// How the bytecode VM holds a value: ints and bools in Register::num, anything
+// else boxed in Register::obj.
+enum class Repr : uint8_t { Int, Bool, Boxed };
+
+struct Register {
+    int num = 0;
+    Polymorphic obj;
+};
+
+// Moves a T between a register and a C++ function.
+template <class T>
+struct RegisterArg {
+    static constexpr Repr repr = Repr::Boxed;
+    static const T& Get(Register& r) { return r.obj.unchecked_as<T>(); }
+    static void Set(Register& r, T x) { r.obj = Polymorphic(std::move(x)); }
+};
+
+template <>
+struct RegisterArg<int> {
+    static constexpr Repr repr = Repr::Int;
+    static int Get(Register& r) { return r.num; }
+    static void Set(Register& r, int x) { r.num = x; }
+};
+
+template <>
+struct RegisterArg<bool> {
+    static constexpr Repr repr = Repr::Bool;
+    static bool Get(Register& r) { return r.num; }
+    static void Set(Register& r, bool x) { r.num = x; }
+};
+
+template <>
+struct RegisterArg<Polymorphic> {
+    static constexpr Repr repr = Repr::Boxed;
+    static const Polymorphic& Get(Register& r) { return r.obj; }
+    static void Set(Register& r, Polymorphic x) { r.obj = std::move(x); }
+};
+
+// Strings are boxed as std::string whatever they come from.
+template <>
+struct RegisterArg<boost::string_view> {
+    static constexpr Repr repr = Repr::Boxed;
+    static boost::string_view Get(Register& r) {
+        return r.obj.unchecked_as<std::string>();
+    }
+    static void Set(Register& r, boost::string_view x) {
+        r.obj = Polymorphic(std::string(x));
+    }
+};
+
+// Builtins of ImportBase() that the bytecode VM runs itself.
+enum class Intrinsic : uint8_t {
+    None,
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Mod,
+    Eq,
+    Le,
+    Ge,
+    Lt,
+    Gt,
+    Not,
+    And,
+    Or,
+    If,
+    Return,
+    Const
+};
+
 class Function {
    public:
     virtual ~Function() = default;
@@ -19,14 +94,30 @@ class Function {
     const Prototype& type() const { return type_; }
 
     virtual Closure GetClosure() = 0;
+    // Number of arguments its closures take.
+    virtual int arity() const = 0;
+
+    // Special functions get their arguments unevaluated, and can't be
+    // Call()ed.
+    virtual bool special() const { return false; }
+    // How Call() takes argument i, or gives its result for i == arity().
+    virtual Repr repr(int i) const = 0;
+    // Calls the function on all its arguments at once, for the bytecode VM.
+    virtual void Call(Register* args, Register& out) = 0;
+
+    Intrinsic intrinsic() const { return intrinsic_; }
+    void set_intrinsic(Intrinsic op) { intrinsic_ = op; }
 
    protected:
     Function(std::string fun, std::string ret)
         : mangled_name_(std::move(fun)), type_(ParseType(std::move(ret))) {}
+    Function(std::string fun, Type type)
+        : mangled_name_(std::move(fun)), type_(type) {}
 
    private:
     std::string mangled_name_;
     Prototype type_;
+    Intrinsic intrinsic_ = Intrinsic::None;
 };
 
 template <class F>
@@ -36,8 +127,38 @@ class NormalFunc : public Function {
     NormalFunc(std::string name, std::string type, F&& f);
 
     Closure GetClosure() override { return Closure::Get(mangled_name(), fun_); }
+    int arity() const override {
+        return ManglerCaller<std::decay_t<F>>::arity;
+    }
+
+    Repr repr(int i) const override {
+        return Reprs(i, std::make_index_sequence<arity_>());
+    }
+
+    void Call(Register* args, Register& out) override {
+        CallImpl(args, out, std::make_index_sequence<arity_>());
+    }
 
    private:
+    using Mangled = ManglerCaller<std::decay_t<F>>;
+    static constexpr int arity_ = Mangled::arity;
+
+    template <size_t N>
+    using Arg =
+        RegisterArg<std::tuple_element_t<N, typename Mangled::args_type>>;
+    using Result = RegisterArg<std::decay_t<typename Mangled::result_type>>;
+
+    template <size_t... Ns>
+    static Repr Reprs(int i, std::index_sequence<Ns...>) {
+        const Repr reprs[] = {Arg<Ns>::repr..., Result::repr};
+        return reprs[i];
+    }
+
+    template <size_t... Ns>
+    void CallImpl(Register* args, Register& out, std::index_sequence<Ns...>) {
+        Result::Set(out, fun_(Arg<Ns>::Get(args[Ns])...));
+    }
+
     F fun_;
 };
 
@@ -50,6 +171,16 @@ class SpecialFun : public Function {
     Closure GetClosure() override {
         return Closure::GetSpecial(mangled_name(), fun_);
     }
+    bool special() const override { return true; }
+    Repr repr(int) const override { return Repr::Boxed; }
+    void Call(Register*, Register&) override {
+        throw std::runtime_error(mangled_name() + " is special");
+    }
+    int arity() const override {
+        return std::tuple_size<std::tuple_element_t<
+            0,
+            typename ManglerCaller<std::decay_t<F>>::args_type>>::value;
+    }
 
    private:
     F fun_;
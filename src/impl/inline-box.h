@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace slip {
+// Owns an object of a class derived from Base, kept in place when it fits in
+// Size bytes and on the heap otherwise, for small objects not to allocate.
+// Only what moves without throwing is kept in place, so that moving a box
+// can't throw. Base needs a virtual destructor and
+//   virtual Base* CopyTo(void* buf) const = 0;
+//   virtual Base* MoveTo(void* buf) = 0;
+// which derived classes implement with Place().
+template <class Base, size_t Size>
+class InlineBox {
+   public:
+    static constexpr size_t kInline = Size;
+
+    // Constructs an Impl into buf, of kInline bytes, when it may stay there,
+    // and on the heap otherwise.
+    template <class Impl, class... Args>
+    static Base* Place(void* buf, Args&&... args) {
+        if (sizeof(Impl) <= kInline &&
+            alignof(Impl) <= alignof(std::max_align_t) &&
+            std::is_nothrow_move_constructible<Impl>::value) {
+            return new (buf) Impl(std::forward<Args>(args)...);
+        }
+        return new Impl(std::forward<Args>(args)...);
+    }
+
+    InlineBox() = default;
+    InlineBox(const InlineBox& x)
+        : ptr_(x.ptr_ ? x.ptr_->CopyTo(&storage_) : nullptr) {}
+    InlineBox(InlineBox&& x) noexcept { Steal(x); }
+    ~InlineBox() { Reset(); }
+
+    // Left empty if the copy throws.
+    InlineBox& operator=(const InlineBox& x) {
+        if (this != &x) {
+            Reset();
+            ptr_ = x.ptr_ ? x.ptr_->CopyTo(&storage_) : nullptr;
+        }
+        return *this;
+    }
+
+    InlineBox& operator=(InlineBox&& x) noexcept {
+        if (this != &x) {
+            Reset();
+            Steal(x);
+        }
+        return *this;
+    }
+
+    template <class Impl, class... Args>
+    void Emplace(Args&&... args) {
+        Reset();
+        ptr_ = Place<Impl>(&storage_, std::forward<Args>(args)...);
+    }
+
+    void Reset() noexcept {
+        if (IsInline()) {
+            ptr_->~Base();
+        } else {
+            delete ptr_;
+        }
+        ptr_ = nullptr;
+    }
+
+    Base* get() const { return ptr_; }
+    Base* operator->() const { return ptr_; }
+
+   private:
+    bool IsInline() const {
+        return static_cast<const void*>(ptr_) == &storage_;
+    }
+
+    // Objects on the heap are handed over, others moved, which Place() made
+    // sure can't throw.
+    void Steal(InlineBox& x) noexcept {
+        if (x.IsInline()) {
+            ptr_ = x.ptr_->MoveTo(&storage_);
+            x.Reset();
+        } else {
+            ptr_ = x.ptr_;
+            x.ptr_ = nullptr;
+        }
+    }
+
+    std::aligned_storage_t<kInline, alignof(std::max_align_t)> storage_;
+    Base* ptr_ = nullptr;
+};
+}  // namespace slip
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace slip {
+// An append-only set of T, numbered in order of insertion, for the hash
+// consing of SymbolTable and TypeTable. Looking up what is there already
+// takes no lock: entries never move once added, and the index is replaced by
+// a bigger one rather than resized in place when it fills up. Adding takes a
+// lock, and fails past limit() entries, for untrusted input not to grow the
+// table without end.
+template <class T>
+class InternTable {
+   public:
+    // Entries are allocated kChunkSize at a time, and there are at most
+    // kMaxChunks chunks.
+    static constexpr size_t kChunkSize = 4096;
+    static constexpr size_t kMaxChunks = 4096;
+
+    InternTable(const char* what, size_t limit) : what_(what) {
+        set_limit(limit);
+        indexes_.emplace_back(new Index(64));
+        index_.store(indexes_.back().get(), std::memory_order_release);
+    }
+    InternTable(const InternTable&) = delete;
+
+    ~InternTable() {
+        size_t size = size_.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < size; ++i) {
+            entry(i).~Entry();
+        }
+        for (auto& chunk : chunks_) {
+            ::operator delete(chunk.load(std::memory_order_relaxed));
+        }
+    }
+
+    // The number of the entry eq() holds for, or -1.
+    template <class Eq>
+    int64_t Find(uint64_t hash, Eq eq) const {
+        hash = Mix(hash);
+        return Probe(*index_.load(std::memory_order_acquire), hash, eq);
+    }
+
+    // The number of the entry eq() holds for, adding make() if there is none.
+    // make() runs under the lock, and may throw to refuse the entry.
+    template <class Eq, class Make>
+    size_t Intern(uint64_t hash, Eq eq, Make make) {
+        int64_t found = Find(hash, eq);
+        if (found >= 0) {
+            return found;
+        }
+        hash = Mix(hash);
+        std::lock_guard<std::mutex> lock(mutex_);
+        Index* index = indexes_.back().get();
+        found = Probe(*index, hash, eq);
+        if (found >= 0) {
+            return found;
+        }
+        size_t id = size_.load(std::memory_order_relaxed);
+        if (id >= limit_.load(std::memory_order_relaxed)) {
+            throw std::runtime_error(std::string("too many ") + what_);
+        }
+        std::atomic<Entry*>& chunk = chunks_[id / kChunkSize];
+        Entry* entries = chunk.load(std::memory_order_relaxed);
+        if (!entries) {
+            entries = static_cast<Entry*>(
+                ::operator new(sizeof(Entry) * kChunkSize));
+            chunk.store(entries, std::memory_order_release);
+        }
+        new (entries + id % kChunkSize) Entry{make(), hash};
+        size_.store(id + 1, std::memory_order_release);
+        // At most half full, for probes to stay short.
+        if (2 * (id + 1) > index->mask + 1) {
+            indexes_.emplace_back(new Index(2 * (index->mask + 1)));
+            index = indexes_.back().get();
+            for (size_t i = 0; i < id; ++i) {
+                Insert(*index, entry(i).hash, i);
+            }
+        }
+        Insert(*index, hash, id);
+        // Older indexes stay, for the readers that are still probing them.
+        index_.store(index, std::memory_order_release);
+        return id;
+    }
+
+    // The reference stays valid as long as the table.
+    const T& operator[](size_t id) const { return entry(id).value; }
+
+    size_t size() const { return size_.load(std::memory_order_acquire); }
+
+    size_t limit() const { return limit_.load(std::memory_order_relaxed); }
+    // Entries already there stay. At most kChunkSize * kMaxChunks.
+    void set_limit(size_t limit) {
+        limit_.store(std::min(limit, kChunkSize * kMaxChunks),
+                     std::memory_order_relaxed);
+    }
+
+   private:
+    struct Entry {
+        T value;
+        uint64_t hash;
+    };
+
+    // Open addressing. A slot holds the high half of the hash of its entry
+    // and its number plus one, 0 when empty.
+    struct Index {
+        explicit Index(size_t capacity)
+            : mask(capacity - 1), slots(new std::atomic<uint64_t>[capacity]) {
+            for (size_t i = 0; i < capacity; ++i) {
+                slots[i].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        size_t mask;
+        std::unique_ptr<std::atomic<uint64_t>[]> slots;
+    };
+
+    // splitmix64's finalizer, for the slot and the tag to both be well
+    // distributed whatever the hash given.
+    static uint64_t Mix(uint64_t h) {
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        return h ^ (h >> 31);
+    }
+
+    template <class Eq>
+    int64_t Probe(const Index& index, uint64_t hash, Eq& eq) const {
+        for (size_t i = hash & index.mask;; i = (i + 1) & index.mask) {
+            uint64_t slot = index.slots[i].load(std::memory_order_acquire);
+            if (!slot) {
+                return -1;
+            }
+            size_t id = static_cast<uint32_t>(slot) - 1;
+            if (slot >> 32 == hash >> 32 && eq(entry(id).value)) {
+                return id;
+            }
+        }
+    }
+
+    static void Insert(Index& index, uint64_t hash, size_t id) {
+        size_t i = hash & index.mask;
+        while (index.slots[i].load(std::memory_order_relaxed)) {
+            i = (i + 1) & index.mask;
+        }
+        index.slots[i].store((hash >> 32 << 32) | (id + 1),
+                             std::memory_order_release);
+    }
+
+    const Entry& entry(size_t id) const {
+        return chunks_[id / kChunkSize].load(
+            std::memory_order_acquire)[id % kChunkSize];
+    }
+
+    const char* what_;
+    std::atomic<size_t> limit_;
+    std::atomic<size_t> size_{0};
+    std::atomic<Entry*> chunks_[kMaxChunks] = {};
+    // The current one is also the last of indexes_.
+    std::atomic<Index*> index_{nullptr};
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Index>> indexes_;
+};
+}  // namespace slip
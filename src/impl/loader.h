@@ -0,0 +1,243 @@
+#pragma once
+
+#include <cctype>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <istream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ast.h"
+#include "context.h"
+#include "eval.h"
+#include "polymorphic.h"
+#include "rd-parser.h"
+#include "typecheck.h"
+
+namespace slip {
+// A fixed capacity FIFO between one producer and one consumer. Closing it
+// wakes up both sides: Push() then fails, and Pop() fails once it is empty.
+template <class T>
+class BoundedQueue {
+   public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+    bool Push(T x) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock,
+                       [&] { return closed_ || items_.size() < capacity_; });
+        if (closed_) {
+            return false;
+        }
+        items_.push_back(std::move(x));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    bool Pop(T& x) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [&] { return closed_ || !items_.empty(); });
+        if (items_.empty()) {
+            return false;
+        }
+        x = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+   private:
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+    std::deque<T> items_;
+    size_t capacity_;
+    bool closed_ = false;
+};
+
+// Cuts a stream into its top-level forms, separated by any whitespace. Only
+// the form being parsed is buffered, read chunk by chunk until it parses. A
+// read takes what has arrived, up to a chunk, rather than waiting for a whole
+// chunk, so that forms of a live stream are returned as soon as they are
+// complete.
+class FormReader {
+   public:
+    FormReader(std::istream& in, size_t chunk_size, size_t max_form_size)
+        : in_(in), chunk_size_(chunk_size), max_form_size_(max_form_size) {}
+
+    // Returns false at the end of the stream. Throws if what's left isn't a
+    // form, or one is longer than max_form_size.
+    bool Next(Val& form) {
+        while (true) {
+            SkipSpace();
+            if (pos_ == buf_.size()) {
+                if (eof_) {
+                    return false;
+                }
+                Fill();
+                continue;
+            }
+
+            // Only a parse that ran into the end of the buffer may change with
+            // more input; any other failure is an error right away.
+            ValBuilder builder;
+            const char* begin = buf_.data() + pos_;
+            RDParser<ValBuilder> parser(
+                begin, buf_.data() + buf_.size(), builder);
+            bool parsed = parser.ParseExpr();
+            if (parsed && (!parser.hit_end() || eof_)) {
+                form.swap(builder.result());
+                pos_ += parser.pos() - begin;
+                // For buffered() not to count the newline after the form.
+                SkipSpace();
+                return true;
+            }
+            if (eof_ || !parser.hit_end()) {
+                throw std::runtime_error("parse error at byte " +
+                                         std::to_string(offset_ + pos_));
+            }
+            if (buf_.size() - pos_ >= max_form_size_) {
+                throw std::runtime_error(
+                    "form at byte " + std::to_string(offset_ + pos_) +
+                    " is longer than " + std::to_string(max_form_size_) +
+                    " bytes");
+            }
+            Fill();
+        }
+    }
+
+    // Whether more than whitespace is left in the buffer. If not, Next() will
+    // have to wait for a read.
+    bool buffered() const { return pos_ != buf_.size(); }
+
+   private:
+    void SkipSpace() {
+        while (pos_ != buf_.size() &&
+               isspace(static_cast<unsigned char>(buf_[pos_]))) {
+            ++pos_;
+        }
+    }
+
+    // Drops what was consumed and appends what has arrived, up to a chunk.
+    // Only waits for the first byte.
+    void Fill() {
+        buf_.erase(0, pos_);
+        offset_ += pos_;
+        pos_ = 0;
+        if (in_.peek() == std::istream::traits_type::eof()) {
+            eof_ = true;
+            return;
+        }
+        size_t size = buf_.size();
+        buf_.resize(size + chunk_size_);
+        size_t got = in_.readsome(&buf_[size], chunk_size_);
+        // Streams that don't tell what they buffer, such as std::cin synced
+        // with stdio, are read a byte at a time.
+        if (got == 0 && in_.get(buf_[size])) {
+            got = 1;
+        }
+        buf_.resize(size + got);
+    }
+
+    std::istream& in_;
+    size_t chunk_size_;
+    size_t max_form_size_;
+    std::string buf_;
+    // Start of the unconsumed input in buf_, and offset of buf_ in the stream.
+    size_t pos_ = 0;
+    size_t offset_ = 0;
+    bool eof_ = false;
+};
+
+// Runs every top-level form of a stream, such as a log of scripts, without
+// loading it whole. A thread reads and parses ahead while the calling thread
+// typechecks and evaluates, so I/O overlaps with evaluation. Forms are handed
+// over in batches of up to batch_size, to synchronize less often, but a batch
+// never waits for a read. Memory is bounded by queue_size batches plus one
+// max_form_size buffer.
+class Loader {
+   public:
+    struct Options {
+        size_t chunk_size = 64 << 10;
+        size_t max_form_size = 1 << 20;
+        size_t batch_size = 16;
+        size_t queue_size = 4;
+    };
+
+    explicit Loader(Context& ctx) : ctx_(ctx) {}
+    Loader(Context& ctx, Options opts) : ctx_(ctx), opts_(opts) {}
+
+    // Calls on_result(const Val& form, Polymorphic& result) for each form, in
+    // order, and returns how many forms ran. Errors are thrown once the forms
+    // before them have run.
+    template <class F>
+    size_t Run(std::istream& in, F on_result) {
+        BoundedQueue<std::vector<Val>> forms(opts_.queue_size);
+        std::exception_ptr error;
+        std::thread reader([&] {
+            std::vector<Val> batch;
+            try {
+                FormReader parser(in, opts_.chunk_size, opts_.max_form_size);
+                Val form;
+                while (parser.Next(form)) {
+                    batch.emplace_back();
+                    batch.back().swap(form);
+                    if (batch.size() == opts_.batch_size ||
+                        !parser.buffered()) {
+                        if (!forms.Push(std::move(batch))) {
+                            return;
+                        }
+                        batch.clear();
+                    }
+                }
+            } catch (...) {
+                error = std::current_exception();
+            }
+            if (!batch.empty()) {
+                forms.Push(std::move(batch));
+            }
+            forms.Close();
+        });
+
+        // Stops the reader if evaluation throws.
+        struct Joiner {
+            ~Joiner() {
+                forms.Close();
+                reader.join();
+            }
+            BoundedQueue<std::vector<Val>>& forms;
+            std::thread& reader;
+        } joiner{forms, reader};
+
+        size_t count = 0;
+        std::vector<Val> batch;
+        while (forms.Pop(batch)) {
+            for (Val& form : batch) {
+                TypedAst typed = Annotate(form, ctx_);
+                Polymorphic result = Eval<Polymorphic>(typed, ctx_);
+                on_result(static_cast<const Val&>(form), result);
+                ++count;
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return count;
+    }
+
+   private:
+    Context& ctx_;
+    Options opts_;
+};
+}  // namespace slip
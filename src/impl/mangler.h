@@ -1,8 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <cctype>
 #include <string>
 #include <type_traits>
 
+#include <boost/utility/string_view.hpp>
+
 #include "type.h"
 
 namespace slip {
@@ -29,12 +33,37 @@ struct GetTypeId<std::string> {
     static std::string type() { return "String"; }
 };
 
+template <>
+struct GetTypeId<boost::string_view> {
+    static std::string type() { return "String"; }
+};
+
+// A name made of letters and digits and starting with a capital is a
+// constant; anything else GetTypeId may return goes through the parser.
+Type TypeFromName(const std::string& name) {
+    auto alnum = [](char c) { return isalnum(static_cast<unsigned char>(c)); };
+    if (!name.empty() && isupper(static_cast<unsigned char>(name[0])) &&
+        std::all_of(name.begin(), name.end(), alnum)) {
+        return ConstType(name);
+    }
+    return ParseType(name).type();
+}
+
+// The Type of T, built once.
+template <class T>
+Type TypeOf() {
+    static const Type type = TypeFromName(GetTypeId<std::decay_t<T>>::type());
+    return type;
+}
+
 template <class... Args>
 struct Mangler;
 
 template <class T>
 struct Mangler<T> {
     static const std::string Mangle() { return GetTypeId<T>::type(); }
+    // T -> ret
+    static Type Signature(Type ret) { return Arrow(TypeOf<T>(), ret); }
 };
 
 template <class A, class... Args>
@@ -42,6 +71,9 @@ struct Mangler<A, Args...> {
     static const std::string Mangle() {
         return GetTypeId<A>::type() + " -> " + Mangler<Args...>::Mangle();
     }
+    static Type Signature(Type ret) {
+        return Arrow(TypeOf<A>(), Mangler<Args...>::Signature(ret));
+    }
 };
 
 template <class F>
@@ -49,8 +81,10 @@ struct ManglerCaller : public ManglerCaller<decltype(&F::operator())> {
     using Impl = ManglerCaller<decltype(&F::operator())>;
     static const std::string Mangle() { return Impl::Mangle(); }
     static const std::string Result() { return Impl::Result(); }
+    static Type Signature() { return Impl::Signature(); }
     using result_type = typename Impl::result_type;
     using args_type = typename Impl::args_type;
+    using raw_args_type = typename Impl::raw_args_type;
     static constexpr int arity = Impl::arity;
 };
 
@@ -60,8 +94,14 @@ struct ManglerCaller<R (*)(Args...)> {
         return Mangler<Args...>::Mangle() + " -> " + Result();
     }
     static const std::string Result() { return GetTypeId<R>::type(); }
+    // The type Mangle() spells, without a string in between.
+    static Type Signature() {
+        static const Type type = Mangler<Args...>::Signature(TypeOf<R>());
+        return type;
+    }
     typedef R result_type;
     typedef std::tuple<std::decay_t<Args>...> args_type;
+    typedef std::tuple<Args...> raw_args_type;
     static constexpr int arity = sizeof...(Args);
 };
 
@@ -69,8 +109,10 @@ template <class R>
 struct ManglerCaller<R (*)()> {
     static const std::string Mangle() { return Result(); }
     static const std::string Result() { return GetTypeId<R>::type(); }
+    static Type Signature() { return TypeOf<R>(); }
     typedef R result_type;
     typedef std::tuple<> args_type;
+    typedef std::tuple<> raw_args_type;
     static constexpr int arity = 0;
 };
 
@@ -80,8 +122,14 @@ struct ManglerCaller<R (C::*)(Args...) const> {
         return Mangler<Args...>::Mangle() + " -> " + Result();
     }
     static const std::string Result() { return GetTypeId<R>::type(); }
+    // The type Mangle() spells, without a string in between.
+    static Type Signature() {
+        static const Type type = Mangler<Args...>::Signature(TypeOf<R>());
+        return type;
+    }
     typedef R result_type;
     typedef std::tuple<std::decay_t<Args>...> args_type;
+    typedef std::tuple<Args...> raw_args_type;
     static constexpr int arity = sizeof...(Args);
 };
 
@@ -89,8 +137,10 @@ template <class R, class C>
 struct ManglerCaller<R (C::*)() const> {
     static const std::string Mangle() { return Result(); }
     static const std::string Result() { return GetTypeId<R>::type(); }
+    static Type Signature() { return TypeOf<R>(); }
     typedef R result_type;
     typedef std::tuple<> args_type;
+    typedef std::tuple<> raw_args_type;
     static constexpr int arity = 0;
 };
 }  // namespace slip
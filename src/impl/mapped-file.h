@@ -0,0 +1,74 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <boost/utility/string_view.hpp>
+
+namespace slip {
+// A read-only file mapped in memory, so that it can be parsed without
+// reading it into a string first. It is a Buffer for ParseScript(): literals
+// of the script then point right into the mapping.
+class MappedFile {
+   public:
+    explicit MappedFile(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("can't open " + path + ": " +
+                                     std::strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            int err = errno;
+            close(fd);
+            throw std::runtime_error("can't stat " + path + ": " +
+                                     std::strerror(err));
+        }
+        size_ = st.st_size;
+        // Mapping nothing is an error, but an empty file is a valid buffer.
+        if (size_ != 0) {
+            void* data = mmap(nullptr, size_, PROT_READ, kFlags, fd, 0);
+            if (data == MAP_FAILED) {
+                int err = errno;
+                close(fd);
+                throw std::runtime_error("can't map " + path + ": " +
+                                         std::strerror(err));
+            }
+            data_ = static_cast<const char*>(data);
+        }
+        close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (data_) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    boost::string_view view() const { return boost::string_view(data_, size_); }
+
+   private:
+    // The whole file is about to be scanned: fault it in all at once rather
+    // than page by page.
+#ifdef MAP_POPULATE
+    static constexpr int kFlags = MAP_PRIVATE | MAP_POPULATE;
+#else
+    static constexpr int kFlags = MAP_PRIVATE;
+#endif
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+}  // namespace slip
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <vector>
@@ -9,51 +10,68 @@
 
 namespace slip {
 namespace {
+// Both are interned or copied straight from the input range rather than
+// accumulated char by char.
 auto ParseAtom() {
-    return parse_while1(
-        parser_pred(parse_char(),
-                    [](char c) { return !isspace(c) && c != '(' && c != ')'; }),
-        std::string(),
-        [](auto str, auto c) {
-            str.push_back(c);
-            return str;
-        });
+    return make_parser([](str_iterator begin, str_iterator end) {
+        auto atom_end = scan_atom(begin, end);
+        if (atom_end == begin) {
+            return ParserRet<Val>();
+        }
+        return make_optional(
+            std::make_pair(Val(Atom(begin, atom_end)), atom_end));
+    });
 }
+
 auto ParseStr() {
-    return (parse_char('"') >>
-            list_of(parser_pred(parse_char(), [](auto c) { return c != '"'; }))
-                << parse_char('"')) %
-           [](const auto& vec) { return std::string(&vec[0], vec.size()); };
+    return make_parser([](str_iterator begin, str_iterator end) {
+        if (begin == end || *begin != '"') {
+            return ParserRet<std::string>();
+        }
+        auto close = scan_char<'"'>(begin + 1, end);
+        if (close == end) {
+            return ParserRet<std::string>();
+        }
+        return make_optional(
+            std::make_pair(std::string(begin + 1, close), close + 1));
+    });
 }
 
 template <class P>
 auto Tok(P p) {
-    return skip_while(parser_pred(parse_char(), isblank)) >> p;
+    return ignore_blank() >> p;
 }
 
 auto ParseValue() {
     auto i_val = parse_uint() % [](auto i) -> Val { return Int(i); };
-    auto atom =
-        ParseAtom() % [](auto&& s) -> Val { return Atom(std::move(s)); };
     auto str = ParseStr() % [](auto&& s) -> Val { return Str(std::move(s)); };
     auto boolp =
         (parse_word("true") % [](const auto&) -> Val { return Bool(true); }) |
         (parse_word("false") % [](const auto&) -> Val { return Bool(false); });
-    return (i_val | str | boolp | atom);
+    return (i_val | str | boolp | ParseAtom());
 }
 }  // namespace
 
-auto ParseExpr() {
-    Parser<Val> expr =
-        (parse_char('(') >> list_of(Tok(recursion(expr) | ParseValue()))
-                                << Tok(parse_char(')'))) %
-        [](auto x) -> Val { return List(std::move(x)); };
-    return expr;
-}
+// expr := '(' (expr | value)* ')'
+struct ExprGrammar {
+    template <class Self>
+    static auto build(Self self) {
+        return (parse_char('(') >> list_of(Tok(self | ParseValue()))
+                                       << Tok(parse_char(')'))) %
+               [](auto x) -> Val { return List(std::move(x)); };
+    }
+};
+
+auto ParseExpr() { return rule<Val, ExprGrammar>(); }
 
-auto Parse(const std::string& input) {
+auto Parse(const char* begin, const char* end) {
     static const auto parser = ParseExpr();
-    return parser(input.begin(), input.end());
+    return parser(begin, end);
+}
+
+// Parses in place: input is not copied.
+auto Parse(boost::string_view input) {
+    return Parse(input.data(), input.data() + input.size());
 }
 
 }  // namespace slip
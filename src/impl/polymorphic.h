@@ -1,9 +1,12 @@
 #pragma once
 
+#include <cstddef>
 #include <memory>
 #include <sstream>
+#include <type_traits>
 
 #include "detect_trait.h"
+#include "inline-box.h"
 
 template <class T>
 using has_to_string = decltype(std::to_string(std::declval<T>()));
@@ -58,8 +61,9 @@ namespace slip {
 class Polymorphic {
    public:
     template <class T>
-    Polymorphic(T x)
-        : value_(std::make_unique<Polymorphic_<T>>(std::move(x))) {}
+    Polymorphic(T x) : tag_(&Tag<T>::id) {
+        value_.Emplace<Polymorphic_<T>>(std::move(x));
+    }
 
     Polymorphic() = default;
 
@@ -69,23 +73,67 @@ class Polymorphic {
     template <class T>
     std::enable_if_t<!std::is_pointer<T>::value, T> as() const;
 
-    Polymorphic(const Polymorphic& x)
-        : value_(x.value_ ? x.value_->Copy() : nullptr) {}
+    // For a value known to be a T, such as results of type checked code: not
+    // even the tag is checked.
+    template <class T>
+    T& unchecked_as() {
+        return static_cast<Polymorphic_<T>*>(value_.get())->value();
+    }
+    template <class T>
+    const T& unchecked_as() const {
+        return static_cast<const Polymorphic_<T>*>(value_.get())->value();
+    }
 
-    Polymorphic(Polymorphic&& x) : value_(std::move(x.value_)) {}
+    Polymorphic(const Polymorphic& x) = default;
+
+    Polymorphic(Polymorphic&& x) noexcept
+        : value_(std::move(x.value_)), tag_(x.tag_) {
+        x.tag_ = nullptr;
+    }
 
     std::string Show() { return value_->Show(); }
 
-    Polymorphic& operator=(Polymorphic&&) = default;
+    Polymorphic& operator=(Polymorphic&& x) noexcept {
+        if (this != &x) {
+            value_ = std::move(x.value_);
+            tag_ = x.tag_;
+            x.tag_ = nullptr;
+        }
+        return *this;
+    }
+
+    Polymorphic& operator=(const Polymorphic& x) {
+        if (this != &x) {
+            // Untagged should the copy throw.
+            tag_ = nullptr;
+            value_ = x.value_;
+            tag_ = x.tag_;
+        }
+        return *this;
+    }
 
    private:
+    // One per payload type: its address identifies the type, so checking it
+    // is a single compare rather than a dynamic_cast. Not const, for no
+    // constant merging to give two types the same address.
+    template <class T>
+    struct Tag {
+        static char id;
+    };
+
     class PolymorphBase {
        public:
-        virtual PolymorphBase* Copy() const = 0;
+        // See InlineBox.
+        virtual PolymorphBase* CopyTo(void* buf) const = 0;
+        virtual PolymorphBase* MoveTo(void* buf) = 0;
         virtual std::string Show() const = 0;
         virtual ~PolymorphBase() {}
     };
 
+    // Enough for ints, bools, pointers and std::strings, so that scalar
+    // results don't allocate.
+    using Box = InlineBox<PolymorphBase, 40>;
+
     template <class T>
     class Polymorphic_ : public PolymorphBase, public Shower<T> {
        public:
@@ -94,8 +142,12 @@ class Polymorphic {
         const T& value() const { return value_; }
         T& value() { return value_; }
 
-        virtual Polymorphic_<T>* Copy() const override {
-            return new Polymorphic_<T>(value_);
+        PolymorphBase* CopyTo(void* buf) const override {
+            return Box::Place<Polymorphic_<T>>(buf, value_);
+        }
+
+        PolymorphBase* MoveTo(void* buf) override {
+            return Box::Place<Polymorphic_<T>>(buf, std::move(value_));
         }
 
         virtual std::string Show() const override {
@@ -105,17 +157,22 @@ class Polymorphic {
        private:
         T value_;
     };
-    std::unique_ptr<PolymorphBase> value_;
+
+    Box value_;
+    // That of the type of value_, kept out of it not to take room inline.
+    const void* tag_ = nullptr;
 };
 
+template <class T>
+char Polymorphic::Tag<T>::id;
+
 template <class T>
 std::enable_if_t<std::is_pointer<T>::value, T> Polymorphic::as() const {
     using t_no_ptr = std::remove_pointer_t<std::decay_t<T>>;
-    auto ptr = dynamic_cast<Polymorphic_<t_no_ptr>*>(value_.get());
-    if (!ptr) {
+    if (tag_ != &Tag<t_no_ptr>::id) {
         return nullptr;
     }
-    return &ptr->value();
+    return &static_cast<Polymorphic_<t_no_ptr>*>(value_.get())->value();
 }
 
 template <class T>
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <array>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/utility/string_view.hpp>
+
+#include "ast.h"
+#include "context.h"
+#include "eval.h"
+#include "polymorphic.h"
+#include "rd-parser.h"
+#include "type.h"
+#include "typecheck.h"
+#include "typed-ast.h"
+
+namespace slip {
+// Infers the types of the placeholders of a script. TypeChecker checks every
+// call on its own, which can't tell what a placeholder has to be: here the
+// whole script is unified at once, so that any use of a placeholder
+// constrains it.
+//
+// A call to an overloaded function takes the first overload that unifies
+// there. When that choice makes the script fail to type further on, the
+// later overloads of the calls before are tried in turn, the latest call
+// first, so that the result is the typing of the earliest choices that work.
+class PlaceholderInference : public boost::static_visitor<Type> {
+   public:
+    // Past this many tries at a typing, the script is rejected.
+    static constexpr size_t kMaxTries = 1024;
+
+    explicit PlaceholderInference(Context& ctx) : ctx_(ctx) {}
+
+    // The type of each placeholder, which has to be Int, Bool or String.
+    std::vector<Type> Infer(const Val& script) {
+        std::exception_ptr first_error;
+        for (size_t tries = 0; tries < kMaxTries; ++tries) {
+            namer_ = Namer();
+            unifier_ = Unifier();
+            params_.clear();
+            calls_ = 0;
+            try {
+                boost::apply_visitor(*this, script);
+                return Resolve();
+            } catch (std::runtime_error&) {
+                if (!first_error) {
+                    first_error = std::current_exception();
+                }
+            }
+            // The next choice of the latest call that has one left, and the
+            // first choice of the calls after it.
+            while (!choices_.empty() &&
+                   (choices_.size() > calls_ ||
+                    choices_.back().first + 1 >= choices_.back().second)) {
+                choices_.pop_back();
+            }
+            if (choices_.empty()) {
+                std::rethrow_exception(first_error);
+            }
+            ++choices_.back().first;
+        }
+        throw std::runtime_error(
+            "ambiguous overloads: too many ways to try to type the script");
+    }
+
+    Type operator()(const Int&) { return IntType().type(); }
+    Type operator()(const Bool&) { return BoolType().type(); }
+    Type operator()(const Str&) { return StringType().type(); }
+    Type operator()(const Atom& x) {
+        int param = PlaceholderIndex(x);
+        if (param < 0) {
+            throw std::runtime_error("not implemented yet");
+        }
+        if (static_cast<size_t>(param) >= params_.size()) {
+            params_.resize(param + 1);
+        }
+        if (params_[param].empty()) {
+            params_[param] = TypeVar(namer_.NewName());
+        }
+        return params_[param];
+    }
+    Type operator()(const List& xs) {
+        if (xs.empty()) {
+            return VoidType().type();
+        }
+        const Atom* fun_name = xs.GetFunAtom();
+        bool named = fun_name && PlaceholderIndex(*fun_name) < 0;
+        Type ty;
+        if (!named) {
+            ty = boost::apply_visitor(*this, xs[0]);
+        }
+        std::vector<Type> args;
+        args.reserve(xs.size() - 1);
+        for (size_t i = 1; i < xs.size(); ++i) {
+            args.push_back(boost::apply_visitor(*this, xs[i]));
+        }
+        if (!named) {
+            return ApplyArgs(ty, args, unifier_);
+        }
+        const std::string& name = fun_name->val();
+        const auto& overloads = ctx_.Overloads(fun_name->symbol());
+        if (overloads.empty()) {
+            throw std::runtime_error("Can't find function " + name);
+        }
+        if (overloads.size() == 1 || args.empty()) {
+            return ApplyArgs(Instance(*overloads[0]), args, unifier_);
+        }
+        // The first overload that unifies, from the one Infer() chose for
+        // this call on a previous try, if any.
+        size_t call = calls_++;
+        if (call == choices_.size()) {
+            choices_.emplace_back(0, overloads.size());
+        }
+        for (size_t& i = choices_[call].first; i < overloads.size(); ++i) {
+            Unifier unifier = unifier_;
+            Type res;
+            try {
+                res = ApplyArgs(Instance(*overloads[i]), args, unifier);
+            } catch (std::runtime_error&) {
+                continue;
+            }
+            unifier_ = std::move(unifier);
+            return res;
+        }
+        throw std::runtime_error("no overload of " + name + " fits");
+    }
+
+   private:
+    // The type of each placeholder, which has to be Int, Bool or String.
+    std::vector<Type> Resolve() {
+        std::vector<Type> types;
+        for (size_t i = 0; i < params_.size(); ++i) {
+            std::string name = "?" + std::to_string(i);
+            if (params_[i].empty()) {
+                throw std::runtime_error(name + " is never used");
+            }
+            Type ty = unifier_.Resolve(params_[i]);
+            if (ty != IntType().type() && ty != BoolType().type() &&
+                ty != StringType().type()) {
+                throw std::runtime_error("can't bind " + name + " of type " +
+                                         Prototype(ty).Show());
+            }
+            types.push_back(ty);
+        }
+        return types;
+    }
+
+    Type Instance(const Function& fun) {
+        Prototype type = fun.type();
+        type.Instantiate(namer_);
+        return type.type();
+    }
+
+    // The type of fun applied to args.
+    Type ApplyArgs(Type fun, const std::vector<Type>& args, Unifier& unifier) {
+        for (Type arg : args) {
+            fun = unifier.Find(fun);
+            if (fun.is_var()) {
+                Type ret = TypeVar(namer_.NewName());
+                unifier.Unify(fun, Arrow(arg, ret));
+                fun = ret;
+            } else if (fun.is_arrow()) {
+                unifier.Unify(fun.lhs(), arg);
+                fun = fun.rhs();
+            } else {
+                throw std::runtime_error(Show(unifier.Resolve(fun)) +
+                                         " is of non-type function");
+            }
+        }
+        return fun;
+    }
+
+    Context& ctx_;
+    Namer namer_;
+    Unifier unifier_;
+    // By index: the type variable of the placeholder, or an empty Type.
+    std::vector<Type> params_;
+    // For each overloaded call, in the order they are reached: the overload
+    // chosen, and how many there are.
+    std::vector<std::pair<size_t, size_t>> choices_;
+    // Overloaded calls reached so far by this try.
+    size_t calls_ = 0;
+};
+
+// A script parsed and typechecked once, to be run many times with different
+// values in place of its placeholders, like a prepared statement. ?0, ?1...
+// stand for values given to Run(), whose types are inferred from how the
+// script uses them:
+//
+//   PreparedScript add(ctx, "(+ ?0 (* ?1 2))");
+//   int x = add.Run<int>(1, 3);
+//
+// Running it neither parses nor infers anything, and evaluates the tree
+// annotated by Annotate(). It may run in several threads at once, and the
+// functions of ctx must not change while it lives.
+class PreparedScript {
+   public:
+    PreparedScript(Context& ctx, boost::string_view text) : ctx_(ctx) {
+        auto res = ParseRD(text);
+        if (!res) {
+            throw std::runtime_error("parse error");
+        }
+        script_ = std::make_unique<const Val>(std::move(res->first));
+        params_ = PlaceholderInference(ctx).Infer(*script_);
+        typed_ = Annotate(*script_, ctx, &params_);
+    }
+
+    size_t param_count() const { return params_.size(); }
+    Type param_type(size_t i) const { return params_[i]; }
+    Type type() const { return typed_.root().type(); }
+
+    // Binds args, ints, bools or strings, to ?0, ?1... in order. Only their
+    // number and types, and the type of the result, are checked.
+    template <class T, class... Args>
+    T Run(Args&&... args) const {
+        if (sizeof...(Args) != params_.size()) {
+            throw std::runtime_error(std::to_string(params_.size()) +
+                                     " parameters expected, " +
+                                     std::to_string(sizeof...(Args)) +
+                                     " given");
+        }
+        // One more, for there to be one at all.
+        const Type types[] = {ParamType(args)..., Type()};
+        for (size_t i = 0; i < params_.size(); ++i) {
+            if (types[i] != params_[i]) {
+                throw std::runtime_error("?" + std::to_string(i) +
+                                         " is of type " + Show(params_[i]));
+            }
+        }
+        std::array<Polymorphic, sizeof...(Args)> values{
+            {Bind(std::forward<Args>(args))...}};
+        TypedVal root(&typed_, 0, values.data());
+        if (!EvaluatesTo<T>::Check(root.type())) {
+            throw std::runtime_error("can't evaluate an expression of type " +
+                                     Prototype(root.type()).Show());
+        }
+        return Eval<T>(root, ctx_);
+    }
+
+   private:
+    static Polymorphic Bind(int x) { return x; }
+    static Polymorphic Bind(bool x) { return x; }
+    static Polymorphic Bind(std::string x) { return x; }
+    static Polymorphic Bind(const char* x) { return std::string(x); }
+
+    static Type ParamType(int) { return IntType().type(); }
+    static Type ParamType(bool) { return BoolType().type(); }
+    static Type ParamType(const std::string&) { return StringType().type(); }
+    static Type ParamType(const char*) { return StringType().type(); }
+
+    Context& ctx_;
+    std::unique_ptr<const Val> script_;
+    std::vector<Type> params_;
+    TypedAst typed_;
+};
+}  // namespace slip
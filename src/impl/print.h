@@ -1,6 +1,7 @@
 #pragma once
 
 #include "ast.h"
+#include "flat-ast.h"
 
 namespace slip {
 namespace {
@@ -13,7 +14,11 @@ class PrintVisitor : public boost::static_visitor<> {
         res_ += std::to_string(x.val()) + ":bool";
     }
     void operator()(const Atom& x) { res_ += x.val() + ":atom"; }
-    void operator()(const Str& x) { res_ += "\"" + x.val() + "\":str"; }
+    void operator()(const Str& x) {
+        res_ += '"';
+        res_.append(x.view().data(), x.view().size());
+        res_ += "\":str";
+    }
     void operator()(const List& xs) {
         res_ += "[";
         for (auto& x : xs) {
@@ -29,6 +34,35 @@ class PrintVisitor : public boost::static_visitor<> {
 
     std::string result() { return res_; }
 };
+
+void PrintFlat(FlatVal x, std::string& res) {
+    switch (x.kind()) {
+        case FlatVal::Kind::Int:
+            res += std::to_string(x.int_val()) + ":int";
+            break;
+        case FlatVal::Kind::Bool:
+            res += std::to_string(x.bool_val()) + ":bool";
+            break;
+        case FlatVal::Kind::Atom:
+            res += x.str() + ":atom";
+            break;
+        case FlatVal::Kind::Str:
+            res += "\"" + x.str() + "\":str";
+            break;
+        case FlatVal::Kind::List:
+            res += "[";
+            for (FlatVal y : x) {
+                PrintFlat(y, res);
+                res += " ";
+            }
+            if (res.back() == ' ') {
+                res.back() = ']';
+            } else {
+                res.push_back(']');
+            }
+            break;
+    }
+}
 }
 
 inline std::string Print(const Val& v) {
@@ -37,4 +71,10 @@ inline std::string Print(const Val& v) {
     return pv.result();
 }
 
+inline std::string Print(FlatVal v) {
+    std::string res;
+    PrintFlat(v, res);
+    return res;
+}
+
 }  // namespace slip
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "parser.h"
+
+namespace slip {
+// Hand-written parser for the grammar of ParseExpr(). Every token is
+// recognized from its first character, so no alternative is ever retried from
+// the same position, and no call goes through a std::function. It accepts and
+// rejects exactly the same inputs as the combinator parser.
+//
+// The tree itself is built by Builder, which is told about every token:
+// OpenList(), CloseList(), AddInt(int), AddBool(bool), and AddStr / AddAtom
+// with the [begin, end) range of their text.
+template <class Builder>
+class RDParser {
+   public:
+    RDParser(const char* begin, const char* end, Builder& builder)
+        : cur_(begin), end_(end), builder_(builder) {}
+
+    // Parses one expression starting at the current position and leaves the
+    // position right after its closing paren.
+    bool ParseExpr() {
+        if (cur_ == end_) {
+            hit_end_ = true;
+            return false;
+        }
+        if (*cur_ != '(') {
+            return false;
+        }
+        ++cur_;
+        builder_.OpenList();
+
+        // Nesting is tracked with a counter rather than by recursing so that
+        // deep scripts don't consume the native stack.
+        size_t depth = 1;
+        while (depth) {
+            SkipBlanks();
+            if (cur_ == end_) {
+                hit_end_ = true;
+                return false;
+            }
+
+            if (*cur_ == '(') {
+                ++cur_;
+                ++depth;
+                builder_.OpenList();
+            } else if (*cur_ == ')') {
+                ++cur_;
+                --depth;
+                builder_.CloseList();
+            } else if (!ParseValue()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const char* pos() const { return cur_; }
+
+    // Whether parsing ran into the end of the input, in which case more input
+    // could parse differently: a failure may only be input cut short. A
+    // success may too, when a string left open was read as an atom.
+    bool hit_end() const { return hit_end_; }
+
+   private:
+    bool StartsWith(const char* word, size_t len) const {
+        return static_cast<size_t>(end_ - cur_) >= len &&
+               std::equal(word, word + len, cur_);
+    }
+
+    void SkipBlanks() { cur_ = scan_blanks(cur_, end_); }
+
+    bool ParseValue() {
+        char c = *cur_;
+        if (isdigit(c)) {
+            const char* digits_end = scan_digits(cur_, end_);
+            builder_.AddInt(static_cast<int>(digits_value(cur_, digits_end)));
+            cur_ = digits_end;
+            return true;
+        }
+
+        if (c == '"') {
+            const char* close = scan_char<'"'>(cur_ + 1, end_);
+            if (close != end_) {
+                builder_.AddStr(cur_ + 1, close);
+                cur_ = close + 1;
+                return true;
+            }
+            // An unterminated string is read back as an atom, like the
+            // combinator parser does.
+            hit_end_ = true;
+        } else if (StartsWith("true", 4)) {
+            cur_ += 4;
+            builder_.AddBool(true);
+            return true;
+        } else if (StartsWith("false", 5)) {
+            cur_ += 5;
+            builder_.AddBool(false);
+            return true;
+        }
+
+        const char* atom_end = scan_atom(cur_, end_);
+        if (atom_end == cur_) {
+            return false;
+        }
+        builder_.AddAtom(cur_, atom_end);
+        cur_ = atom_end;
+        return true;
+    }
+
+    const char* cur_;
+    const char* end_;
+    Builder& builder_;
+    bool hit_end_ = false;
+};
+
+// Builds the usual boost::variant tree. With borrow_strings, string literals
+// are views into the parsed buffer rather than copies.
+class ValBuilder {
+   public:
+    explicit ValBuilder(bool borrow_strings = false)
+        : borrow_strings_(borrow_strings) {}
+
+    void OpenList() { frames_.push_back(stack_.size()); }
+
+    void CloseList() {
+        size_t first = frames_.back();
+        frames_.pop_back();
+
+        // Swapping instead of moving keeps the nested lists where they are:
+        // moving a recursive_wrapper allocates.
+        std::vector<Val> vals(stack_.size() - first);
+        for (size_t i = 0; i < vals.size(); ++i) {
+            vals[i].swap(stack_[first + i]);
+        }
+        stack_.erase(stack_.begin() + first, stack_.end());
+
+        if (frames_.empty()) {
+            result_ = List(std::move(vals));
+        } else {
+            stack_.emplace_back(List(std::move(vals)));
+        }
+    }
+
+    void AddInt(int i) { stack_.emplace_back(Int(i)); }
+    void AddBool(bool b) { stack_.emplace_back(Bool(b)); }
+    void AddStr(const char* b, const char* e) {
+        if (borrow_strings_) {
+            stack_.emplace_back(Str::Borrow(boost::string_view(b, e - b)));
+        } else {
+            stack_.emplace_back(Str(std::string(b, e)));
+        }
+    }
+    void AddAtom(const char* b, const char* e) {
+        stack_.emplace_back(Atom(b, e));
+    }
+    void AddSymbol(int symbol) {
+        stack_.emplace_back(Atom::FromSymbol(symbol));
+    }
+
+    Val& result() {
+        // A root that isn't a list is still on the stack.
+        if (frames_.empty() && !stack_.empty()) {
+            result_.swap(stack_.back());
+            stack_.pop_back();
+        }
+        return result_;
+    }
+
+   private:
+    // Values of the lists still open, innermost last. A deque never moves its
+    // elements when it grows.
+    std::deque<Val> stack_;
+    std::vector<size_t> frames_;
+    Val result_;
+    bool borrow_strings_;
+};
+
+ParserRet<Val> ParseRD(boost::string_view input) {
+    ValBuilder builder;
+    RDParser<ValBuilder> parser(
+        input.data(), input.data() + input.size(), builder);
+    if (!parser.ParseExpr()) {
+        return ParserRet<Val>();
+    }
+    return make_optional(
+        std::make_pair(std::move(builder.result()), parser.pos()));
+}
+
+enum class ParserKind { Combinator, RecursiveDescent };
+
+ParserRet<Val> Parse(boost::string_view input, ParserKind kind) {
+    if (kind == ParserKind::RecursiveDescent) {
+        return ParseRD(input);
+    }
+    return Parse(input);
+}
+
+}  // namespace slip
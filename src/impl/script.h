@@ -0,0 +1,47 @@
+#pragma once
+
+#include <memory>
+
+#include "ast.h"
+#include "mapped-file.h"
+#include "rd-parser.h"
+
+namespace slip {
+// A parsed expression along with the buffer it was parsed from. Its string
+// literals are views into that buffer instead of copies, which is why the
+// script keeps the buffer alive. Copies of root() taken out of the script
+// must not outlive it.
+class Script {
+   public:
+    Script() = default;
+    Script(std::shared_ptr<const void> buffer, Val root)
+        : buffer_(std::move(buffer)), root_(std::move(root)) {}
+
+    const Val& root() const { return root_; }
+    Val& root() { return root_; }
+
+   private:
+    std::shared_ptr<const void> buffer_;
+    Val root_;
+};
+
+// Buffer is any contiguous container of chars, with data() and size(). The
+// caller can keep using it, but not modify it, while the script is alive.
+template <class Buffer>
+optional<Script> ParseScript(std::shared_ptr<const Buffer> buffer) {
+    ValBuilder builder(/* borrow_strings = */ true);
+    RDParser<ValBuilder> parser(
+        buffer->data(), buffer->data() + buffer->size(), builder);
+    if (!parser.ParseExpr()) {
+        return optional<Script>();
+    }
+    return make_optional(
+        Script(std::move(buffer), std::move(builder.result())));
+}
+
+// Parses a script file in place: the file is mapped rather than read, and
+// stays mapped as long as the script is alive.
+optional<Script> ParseFile(const std::string& path) {
+    return ParseScript(std::shared_ptr<const MappedFile>(new MappedFile(path)));
+}
+}  // namespace slip
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+
+#include <boost/utility/string_view.hpp>
+
+#include "intern.h"
+
+namespace slip {
+// Interns names into small integer ids. Atoms are interned at parse time and
+// Context indexes its functions by the same ids, so resolving a call is an
+// integer lookup. There is one table per process, which is what lets scripts
+// be parsed without knowing which Context will run them. Names are never
+// removed, so the table is bounded instead: interning a new name past
+// limit() names or byte_limit() bytes of them throws. Names already there
+// are found without taking a lock.
+class SymbolTable {
+   public:
+    static SymbolTable& Global() {
+        static SymbolTable table;
+        return table;
+    }
+
+    // Returns the id of name, creating it if needed. Only the first
+    // occurrence of a name allocates.
+    int Intern(boost::string_view name) {
+        return names_.Intern(
+            Hash(name),
+            [&](const std::string& s) { return s == name; },
+            [&] {
+                if (bytes_ + name.size() > byte_limit_) {
+                    throw std::runtime_error("too many bytes of symbols");
+                }
+                bytes_ += name.size();
+                return name.to_string();
+            });
+    }
+
+    // Returns the id of name, or -1 if it was never interned.
+    int Find(boost::string_view name) const {
+        return names_.Find(Hash(name),
+                           [&](const std::string& s) { return s == name; });
+    }
+
+    // The reference stays valid forever.
+    const std::string& Name(int id) const { return names_[id]; }
+
+    size_t size() const { return names_.size(); }
+    size_t bytes() const { return bytes_; }
+
+    size_t limit() const { return names_.limit(); }
+    void set_limit(size_t names) { names_.set_limit(names); }
+    size_t byte_limit() const { return byte_limit_; }
+    void set_byte_limit(size_t bytes) { byte_limit_ = bytes; }
+
+   private:
+    SymbolTable() = default;
+    SymbolTable(const SymbolTable&) = delete;
+
+    // FNV-1a
+    static uint64_t Hash(boost::string_view s) {
+        uint64_t h = 14695981039346656037ull;
+        for (char c : s) {
+            h = (h ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        }
+        return h;
+    }
+
+    InternTable<std::string> names_{"symbols", 1 << 20};
+    // Only changed under the lock of names_.
+    std::atomic<size_t> bytes_{0};
+    std::atomic<size_t> byte_limit_{64 << 20};
+};
+}  // namespace slip
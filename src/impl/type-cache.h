@@ -0,0 +1,228 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "ast.h"
+#include "type.h"
+
+namespace slip {
+namespace {
+// FNV-1a, a word at a time.
+const uint64_t kHashPrime = 0x100000001b3ULL;
+
+uint64_t HashMix(uint64_t h, uint64_t x) { return (h ^ x) * kHashPrime; }
+
+struct HashVisitor : public boost::static_visitor<> {
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    // The type of a literal doesn't depend on its value.
+    void operator()(const Int&) { h = HashMix(h, 0); }
+    void operator()(const Bool&) { h = HashMix(h, 1); }
+    void operator()(const Atom& x) { h = HashMix(HashMix(h, 2), x.symbol()); }
+    void operator()(const Str&) { h = HashMix(h, 3); }
+    void operator()(const List& xs) {
+        h = HashMix(HashMix(h, 4), xs.size());
+        for (auto& x : xs) {
+            boost::apply_visitor(*this, x);
+        }
+    }
+};
+
+struct EqualVisitor : public boost::static_visitor<bool> {
+    bool operator()(const Int&, const Int&) const { return true; }
+    bool operator()(const Bool&, const Bool&) const { return true; }
+    bool operator()(const Atom& a, const Atom& b) const { return a == b; }
+    bool operator()(const Str&, const Str&) const { return true; }
+    bool operator()(const List& a, const List& b) const {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); ++i) {
+            if (!boost::apply_visitor(*this, a[i], b[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+    template <class A, class B>
+    bool operator()(const A&, const B&) const {
+        return false;
+    }
+};
+
+// A copy of the shape of a tree: its strings are left empty, which also
+// keeps it from pointing into the buffer they may be borrowed from.
+struct ShapeCopyVisitor : public boost::static_visitor<Val> {
+    Val operator()(const Str&) const { return Str(std::string()); }
+    Val operator()(const List& xs) const {
+        std::vector<Val> vals;
+        vals.reserve(xs.size());
+        for (auto& x : xs) {
+            vals.push_back(boost::apply_visitor(*this, x));
+        }
+        return List(std::move(vals));
+    }
+    template <class T>
+    Val operator()(const T& x) const {
+        return x;
+    }
+};
+
+// The overloads the atoms of a tree are bound to, in preorder.
+struct AtomBindings : public boost::static_visitor<> {
+    std::vector<int> overloads;
+    bool any = false;
+
+    void operator()(const Atom& x) {
+        overloads.push_back(x.overload());
+        any = any || x.overload();
+    }
+    void operator()(const List& xs) {
+        for (auto& x : xs) {
+            boost::apply_visitor(*this, x);
+        }
+    }
+    template <class T>
+    void operator()(const T&) {}
+};
+
+// With overloads null, to the first ones.
+struct BindAtoms : public boost::static_visitor<> {
+    explicit BindAtoms(const int* overloads) : overload(overloads) {}
+
+    const int* overload;
+
+    void operator()(const Atom& x) { x.Bind(overload ? *overload++ : 0); }
+    void operator()(const List& xs) {
+        for (auto& x : xs) {
+            boost::apply_visitor(*this, x);
+        }
+    }
+    template <class T>
+    void operator()(const T&) {}
+};
+}  // namespace
+
+// Trees of the same shape, that is which differ at most by the values of
+// their literals, hash the same.
+size_t StructuralHash(const Val& x) {
+    HashVisitor hasher;
+    boost::apply_visitor(hasher, x);
+    return hasher.h;
+}
+
+bool StructurallyEqual(const Val& a, const Val& b) {
+    return boost::apply_visitor(EqualVisitor(), a, b);
+}
+
+// Types of whole scripts, for hosts that check scripts of the same few shapes
+// over and over, such as calls differing only by their arguments. Scripts are
+// found by their structural hash and then compared in full, so that a
+// collision can't give a wrong type. Entries hold on to a copy of the shape
+// of their script and of the overloads its calls were bound to, and the least
+// recently used ones go first.
+class TypeCache {
+   public:
+    TypeCache() = default;
+    TypeCache(const TypeCache&) = delete;
+
+    bool Find(const Val& script, size_t hash, Type* result) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto range = index_.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (StructurallyEqual(it->second->script, script)) {
+                ++hits_;
+                lru_.splice(lru_.begin(), lru_, it->second);
+                *result = it->second->type;
+                const std::vector<int>& overloads = it->second->overloads;
+                BindAtoms binder(overloads.empty() ? nullptr
+                                                   : overloads.data());
+                boost::apply_visitor(binder, script);
+                return true;
+            }
+        }
+        ++misses_;
+        return false;
+    }
+
+    // script must have been type checked, for its atoms to be bound.
+    void Insert(const Val& script, size_t hash, Type result) {
+        Val copy = boost::apply_visitor(ShapeCopyVisitor(), script);
+        AtomBindings bindings;
+        boost::apply_visitor(bindings, script);
+        if (!bindings.any) {
+            bindings.overloads.clear();
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!capacity_) {
+            return;
+        }
+        // Another thread may have checked the same script meanwhile.
+        auto range = index_.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (StructurallyEqual(it->second->script, copy)) {
+                return;
+            }
+        }
+        lru_.push_front(Entry{
+            hash, std::move(copy), result, std::move(bindings.overloads)});
+        index_.emplace(hash, lru_.begin());
+        if (lru_.size() > capacity_) {
+            auto range = index_.equal_range(lru_.back().hash);
+            for (auto it = range.first; it != range.second; ++it) {
+                if (it->second == std::prev(lru_.end())) {
+                    index_.erase(it);
+                    break;
+                }
+            }
+            lru_.pop_back();
+        }
+    }
+
+    size_t hits() const { return hits_; }
+    size_t misses() const { return misses_; }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return lru_.size();
+    }
+
+    size_t capacity() const { return capacity_; }
+
+    // Also empties the cache. 0 disables it.
+    void set_capacity(size_t capacity) {
+        capacity_ = capacity;
+        Clear();
+    }
+
+    void Clear() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        index_.clear();
+        lru_.clear();
+        hits_ = 0;
+        misses_ = 0;
+    }
+
+   private:
+    struct Entry {
+        size_t hash;
+        Val script;
+        Type type;
+        // Empty if they are all the first.
+        std::vector<int> overloads;
+    };
+
+    std::mutex mutex_;
+    // Most recently used first.
+    std::list<Entry> lru_;
+    std::unordered_multimap<size_t, std::list<Entry>::iterator> index_;
+    std::atomic<size_t> capacity_{1024};
+    std::atomic<size_t> hits_{0};
+    std::atomic<size_t> misses_{0};
+};
+}  // namespace slip
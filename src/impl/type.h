@@ -1,14 +1,22 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
+#include <list>
 #include <map>
 #include <memory>
-#include <set>
+#include <mutex>
 #include <sstream>
+#include <unordered_map>
+#include <vector>
 
+#include "intern.h"
 #include "parcxx/src/parcxx.h"
+#include "symbol.h"
 
-#include <boost/variant.hpp>
+#include <boost/utility/string_view.hpp>
 
 namespace slip {
 
@@ -34,34 +42,141 @@ class TypeVar {
 
 struct ConstType {
    public:
-    ConstType(std::string str) : name_(std::move(str)) {}
+    ConstType(boost::string_view name)
+        : sym_(SymbolTable::Global().Intern(name)) {}
 
-    const std::string& name() const { return name_; }
+    int symbol() const { return sym_; }
+    const std::string& name() const { return SymbolTable::Global().Name(sym_); }
 
    private:
-    std::string name_;
+    int sym_;
 };
 
 class Arrow;
-using Type =
-    boost::variant<TypeVar, ConstType, boost::recursive_wrapper<Arrow>>;
 
-class Arrow {
+// A node of the type DAG. Var: id is the variable. Const: id is the symbol of
+// the name. Arrow: lhs and rhs.
+struct TypeNode {
+    enum class Kind : uint8_t { Var, Const, Arrow };
+
+    Kind kind;
+    bool has_vars;
+    int id;
+    int arity;
+    const TypeNode* lhs;
+    const TypeNode* rhs;
+};
+
+// Stores every distinct type once. Like symbols, nodes are never freed: a
+// program only ever builds a limited set of types, and Namer reuses the
+// names of type variables. Past limit() nodes, building a new type throws.
+// Types already there are found without taking a lock.
+class TypeTable {
    public:
-    Arrow() = default;
+    static TypeTable& Global() {
+        static TypeTable table;
+        return table;
+    }
+
+    const TypeNode* Intern(TypeNode::Kind kind,
+                           int id,
+                           const TypeNode* lhs,
+                           const TypeNode* rhs) {
+        // Children are interned already, so they are compared by address.
+        uint64_t h = static_cast<uint64_t>(kind) * 31 + id;
+        h = h * 1000003 ^ reinterpret_cast<uintptr_t>(lhs);
+        h = h * 1000003 ^ reinterpret_cast<uintptr_t>(rhs);
+        size_t found = nodes_.Intern(
+            h,
+            [&](const TypeNode& n) {
+                return n.kind == kind && n.id == id && n.lhs == lhs &&
+                       n.rhs == rhs;
+            },
+            [&] {
+                TypeNode node{kind, false, id, 0, lhs, rhs};
+                if (kind == TypeNode::Kind::Arrow) {
+                    node.has_vars = lhs->has_vars || rhs->has_vars;
+                    node.arity = 1 + rhs->arity;
+                } else {
+                    node.has_vars = kind == TypeNode::Kind::Var;
+                }
+                return node;
+            });
+        return &nodes_[found];
+    }
+
+    size_t size() const { return nodes_.size(); }
+    size_t limit() const { return nodes_.limit(); }
+    void set_limit(size_t nodes) { nodes_.set_limit(nodes); }
+
+   private:
+    TypeTable() = default;
+    TypeTable(const TypeTable&) = delete;
 
-    Arrow(Type lhs, Type rhs) : lhs_(std::move(lhs)), rhs_(std::move(rhs)) {}
+    InternTable<TypeNode> nodes_{"types", 1 << 20};
+};
 
-    Type& lhs() { return lhs_; }
-    Type& rhs() { return rhs_; }
-    const Type& lhs() const { return lhs_; }
-    const Type& rhs() const { return rhs_; }
+// A type, hash-consed into the TypeTable: equal types are the same node, so
+// they compare by pointer, and copying a Type copies a pointer. Types are
+// immutable; building one only allocates the nodes that didn't exist yet.
+class Type {
+   public:
+    using Kind = TypeNode::Kind;
+
+    // No type at all, only good to be assigned to.
+    Type() = default;
+    Type(const TypeVar& v)
+        : node_(TypeTable::Global().Intern(
+              Kind::Var, v.id(), nullptr, nullptr)) {}
+    Type(const ConstType& c)
+        : node_(TypeTable::Global().Intern(
+              Kind::Const, c.symbol(), nullptr, nullptr)) {}
+    Type(const Arrow& a);
+
+    bool empty() const { return !node_; }
+    Kind kind() const { return node_->kind; }
+    bool is_var() const { return kind() == Kind::Var; }
+    bool is_const() const { return kind() == Kind::Const; }
+    bool is_arrow() const { return kind() == Kind::Arrow; }
+
+    // Var: the variable. Const: the symbol of the name.
+    int id() const { return node_->id; }
+    const std::string& name() const { return SymbolTable::Global().Name(id()); }
+    Type lhs() const { return Type(node_->lhs); }
+    Type rhs() const { return Type(node_->rhs); }
+
+    // Number of arrows along the right spine.
+    int arity() const { return node_->arity; }
+    // Whether any type variable appears in it.
+    bool has_vars() const { return node_->has_vars; }
+
+    bool operator==(Type o) const { return node_ == o.node_; }
+    bool operator!=(Type o) const { return node_ != o.node_; }
+    size_t hash() const { return std::hash<const void*>()(node_); }
+
+   private:
+    explicit Type(const TypeNode* node) : node_(node) {}
+
+    const TypeNode* node_ = nullptr;
+};
+
+class Arrow {
+   public:
+    Arrow(Type lhs, Type rhs) : lhs_(lhs), rhs_(rhs) {}
+
+    Type lhs() const { return lhs_; }
+    Type rhs() const { return rhs_; }
 
    private:
     Type lhs_;
     Type rhs_;
 };
 
+inline Type::Type(const Arrow& a) {
+    Type lhs = a.lhs(), rhs = a.rhs();
+    node_ = TypeTable::Global().Intern(Kind::Arrow, 0, lhs.node_, rhs.node_);
+}
+
 std::string IdToLetters(int id) {
     std::string res;
     res.insert(res.begin(), id % 26 + 'a');
@@ -73,182 +188,356 @@ std::string IdToLetters(int id) {
     return res;
 }
 
-class TypeShowVisitor : public boost::static_visitor<void> {
-   public:
-    TypeShowVisitor() : arg_(From::Left) {}
+namespace {
+void ShowType(Type ty, bool parens, std::string& res) {
+    switch (ty.kind()) {
+        case Type::Kind::Var:
+            res += IdToLetters(ty.id());
+            break;
+        case Type::Kind::Const:
+            res += ty.name();
+            break;
+        case Type::Kind::Arrow:
+            if (parens) {
+                res += "(";
+            }
+            ShowType(ty.lhs(), true, res);
+            res += " -> ";
+            ShowType(ty.rhs(), false, res);
+            if (parens) {
+                res += ")";
+            }
+            break;
+    }
+}
+}  // namespace
 
-    void operator()(const TypeVar& tv) { res_ += IdToLetters(tv.id()); }
+std::string Show(const Type& ty) {
+    std::string res;
+    ShowType(ty, false, res);
+    return res;
+}
 
-    void operator()(const ConstType& t) { res_ += t.name(); }
+// A sorted set of type variables. Types seldom have more than a handful,
+// which are kept inline rather than allocated.
+class TypeVars {
+   public:
+    TypeVars() = default;
+    TypeVars(const TypeVars&) = delete;
 
-    void operator()(const Arrow& arr) {
-        From from = arg_;
-        if (from == From::Right) {
-            res_ += "(";
+    void Insert(int var) {
+        int* end = data() + size_;
+        int* pos = std::lower_bound(data(), end, var);
+        if (pos != end && *pos == var) {
+            return;
         }
-        arg_ = From::Right;
-        boost::apply_visitor(*this, arr.lhs());
-
-        res_ += " -> ";
-
-        arg_ = From::Left;
-        boost::apply_visitor(*this, arr.rhs());
-        if (from == From::Right) {
-            res_ += ")";
+        size_t idx = pos - data();
+        if (size_ == kInline && spilled_.empty()) {
+            spilled_.assign(inline_, inline_ + kInline);
+        }
+        if (!spilled_.empty()) {
+            spilled_.insert(spilled_.begin() + idx, var);
+        } else {
+            std::copy_backward(pos, end, end + 1);
+            *pos = var;
         }
+        ++size_;
     }
-    const std::string& result() const { return res_; }
+
+    // Position of var in the set, or -1.
+    int IndexOf(int var) const {
+        const int* pos = std::lower_bound(begin(), end(), var);
+        return pos != end() && *pos == var ? pos - begin() : -1;
+    }
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+    const int* begin() const { return data(); }
+    const int* end() const { return data() + size_; }
 
    private:
-    enum class From { Left, Right };
-    From arg_;
-    std::string res_;
+    static const size_t kInline = 8;
+
+    int* data() { return spilled_.empty() ? inline_ : spilled_.data(); }
+    const int* data() const {
+        return spilled_.empty() ? inline_ : spilled_.data();
+    }
+
+    int inline_[kInline];
+    size_t size_ = 0;
+    std::vector<int> spilled_;
 };
 
-std::string Show(const Type& ty) {
-    TypeShowVisitor tsv;
-    boost::apply_visitor(tsv, ty);
-    return tsv.result();
+void FindVars(Type ty, TypeVars& vars) {
+    if (!ty.has_vars()) {
+        return;
+    }
+    if (ty.is_var()) {
+        vars.Insert(ty.id());
+        return;
+    }
+    FindVars(ty.lhs(), vars);
+    FindVars(ty.rhs(), vars);
 }
 
-struct FindVarsVisitor : public boost::static_visitor<void> {
-    std::set<int> vars_;
-    void operator()(const TypeVar& tv) { vars_.insert(tv.id()); }
-    void operator()(const ConstType&) {}
-    void operator()(const Arrow& r) {
-        boost::apply_visitor(*this, r.lhs());
-        boost::apply_visitor(*this, r.rhs());
+// Renames the i-th variable of vars to first + i.
+Type Rename(const TypeVars& vars, int first, Type ty) {
+    if (!ty.has_vars()) {
+        return ty;
     }
-    const std::set<int>& result() const { return vars_; }
-};
+    if (ty.is_var()) {
+        return TypeVar(first + vars.IndexOf(ty.id()));
+    }
+    return Arrow(Rename(vars, first, ty.lhs()), Rename(vars, first, ty.rhs()));
+}
 
 using Substitutions = std::map<int, Type>;
 
-struct UnifyVisitor : public boost::static_visitor<void> {
-    Substitutions subs_;
-    const Type* ptr_;
+// Only the spine leading to substituted variables is rebuilt: subtrees
+// without them are shared with ty.
+Type Substitute(const Substitutions& subs, Type ty) {
+    if (!ty.has_vars()) {
+        return ty;
+    }
+    if (ty.is_var()) {
+        auto found = subs.find(ty.id());
+        return found == subs.end() ? ty : found->second;
+    }
+    Type lhs = Substitute(subs, ty.lhs());
+    Type rhs = Substitute(subs, ty.rhs());
+    if (lhs == ty.lhs() && rhs == ty.rhs()) {
+        return ty;
+    }
+    return Arrow(lhs, rhs);
+}
 
-    UnifyVisitor(const Type* ptr) : ptr_(ptr) {}
+// Unifies types by binding their variables in place, union-find style:
+// each variable points to what it was unified with, possibly another
+// variable, and lookups compress the chains they follow. Binding the same
+// variable twice unifies what it is bound to.
+class Unifier {
+   public:
+    // What ty is bound to, if it's a bound variable.
+    Type Find(Type ty) {
+        if (!ty.is_var() || !IsBound(ty.id())) {
+            return ty;
+        }
+        Type root = Find(bound_[ty.id()]);
+        bound_[ty.id()] = root;
+        return root;
+    }
 
-    void Bind(const TypeVar& tv, const Type& ty) {
-        auto inserted = subs_.insert(std::make_pair(tv.id(), ty));
-        if (!inserted.second) {
-            throw std::runtime_error("t" + std::to_string(tv.id()) +
-                                     " was already bound to " +
-                                     Show(inserted.first->second));
+    // Variables of lhs are bound first, so a variable unified with another
+    // takes its name.
+    void Unify(Type lhs, Type rhs) {
+        lhs = Find(lhs);
+        rhs = Find(rhs);
+        if (lhs == rhs) {
+            return;
+        }
+        if (lhs.is_var()) {
+            Bind(lhs.id(), rhs);
+        } else if (rhs.is_var()) {
+            Bind(rhs.id(), lhs);
+        } else if (lhs.is_arrow() && rhs.is_arrow()) {
+            Unify(lhs.lhs(), rhs.lhs());
+            Unify(lhs.rhs(), rhs.rhs());
+        } else {
+            throw std::runtime_error("Can't unify " + Show(Resolve(lhs)) +
+                                     " and " + Show(Resolve(rhs)));
         }
     }
 
-    void operator()(const TypeVar& tv) { Bind(tv, *ptr_); }
+    // ty with all its bound variables replaced, recursively. Subtrees
+    // without bound variables are shared with ty.
+    Type Resolve(Type ty) {
+        if (!ty.has_vars()) {
+            return ty;
+        }
+        if (ty.is_var()) {
+            Type found = Find(ty);
+            return found == ty ? ty : Resolve(found);
+        }
+        Type lhs = Resolve(ty.lhs());
+        Type rhs = Resolve(ty.rhs());
+        if (lhs == ty.lhs() && rhs == ty.rhs()) {
+            return ty;
+        }
+        return Arrow(lhs, rhs);
+    }
 
-    void operator()(const ConstType& ct) {
-        auto as_const_type = boost::get<ConstType>(ptr_);
-        if (as_const_type) {
-            if (ct.name() == as_const_type->name()) {
-                return;
-            }
+   private:
+    bool IsBound(int var) const {
+        return static_cast<size_t>(var) < bound_.size() &&
+               !bound_[var].empty();
+    }
 
-            throw std::runtime_error("Can't unify " + Show(ct) + " and " +
-                                     Show(*ptr_));
+    void Bind(int var, Type ty) {
+        if (Occurs(var, ty)) {
+            throw std::runtime_error("Can't unify " + IdToLetters(var) +
+                                     " and " + Show(Resolve(ty)) +
+                                     ": infinite type");
         }
-        auto as_type_var = boost::get<TypeVar>(ptr_);
-        if (as_type_var) {
-            Bind(*as_type_var, ct);
-            return;
+        if (static_cast<size_t>(var) >= bound_.size()) {
+            bound_.resize(var + 1);
         }
-        throw std::runtime_error("Can't unify " + Show(ct) + " and " +
-                                 Show(*ptr_));
+        bound_[var] = ty;
     }
 
-    void operator()(const Arrow& ct) {
-        auto as_arrow = boost::get<Arrow>(ptr_);
-        if (!as_arrow) {
-            throw std::runtime_error("Can't unify " + Show(ct) + " and " +
-                                     Show(*ptr_));
+    bool Occurs(int var, Type ty) {
+        if (!ty.has_vars()) {
+            return false;
         }
-        ptr_ = &as_arrow->lhs();
-        boost::apply_visitor(*this, ct.lhs());
-
-        ptr_ = &as_arrow->rhs();
-        boost::apply_visitor(*this, ct.rhs());
+        ty = Find(ty);
+        if (ty.is_var()) {
+            return ty.id() == var;
+        }
+        return ty.is_arrow() &&
+               (Occurs(var, ty.lhs()) || Occurs(var, ty.rhs()));
     }
 
-    Substitutions result() { return std::move(subs_); }
+    // By variable: what it is bound to, or an empty Type.
+    std::vector<Type> bound_;
 };
 
-Substitutions Bind(const Type& lhs, const Type& rhs) {
-    UnifyVisitor uvis(&rhs);
-    boost::apply_visitor(uvis, lhs);
-    return uvis.result();
-}
-
-class ApplySubstitution : public boost::static_visitor<> {
+// Results of Prototype::Apply and Substitue, keyed on their instantiated
+// operands: instantiation renames variables in a canonical order, so the
+// result only depends on those. Failed applications aren't cached. The cache
+// is shared by every thread, and split into shards that each have their own
+// lock and evict their least recently used entry when full.
+class ApplyCache {
    public:
-    ApplySubstitution(const Substitutions& subs, Type* root)
-        : subs_(subs), parent_(root) {}
+    // Calls with more arguments aren't cached.
+    static const size_t kMaxArgs = 6;
+
+    struct Key {
+        // -1 for Apply, the variable for Substitue.
+        int op;
+        uint8_t size;
+        // The function, then the arguments.
+        Type types[kMaxArgs + 1];
+
+        bool operator==(const Key& o) const {
+            return op == o.op && size == o.size &&
+                   std::equal(types, types + size, o.types);
+        }
+    };
 
-    void operator()(TypeVar& tv) {
-        auto found = subs_.find(tv.id());
-        if (found == subs_.end()) {
+    static ApplyCache& Global() {
+        static ApplyCache cache;
+        return cache;
+    }
+
+    bool Find(const Key& key, Type* result) {
+        Shard& shard = ShardOf(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.index.find(key);
+        if (found == shard.index.end()) {
+            ++misses_;
+            return false;
+        }
+        ++hits_;
+        shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+        *result = found->second->second;
+        return true;
+    }
+
+    void Insert(const Key& key, Type result) {
+        Shard& shard = ShardOf(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.index.count(key)) {
             return;
         }
-        *parent_ = found->second;
+        shard.lru.emplace_front(key, result);
+        shard.index.emplace(key, shard.lru.begin());
+        if (shard.index.size() > std::max<size_t>(capacity_ / kShards, 1)) {
+            shard.index.erase(shard.lru.back().first);
+            shard.lru.pop_back();
+        }
     }
 
-    void operator()(ConstType&) {}
+    size_t hits() const { return hits_; }
+    size_t misses() const { return misses_; }
 
-    void operator()(Arrow& arr) {
-        parent_ = &arr.lhs();
-        boost::apply_visitor(*this, arr.lhs());
+    size_t size() {
+        size_t total = 0;
+        for (Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            total += shard.index.size();
+        }
+        return total;
+    }
 
-        parent_ = &arr.rhs();
-        boost::apply_visitor(*this, arr.rhs());
+    size_t capacity() const { return capacity_; }
+
+    // Also empties the cache. 0 disables it.
+    void set_capacity(size_t capacity) {
+        capacity_ = capacity;
+        Clear();
+    }
+
+    void Clear() {
+        for (Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.index.clear();
+            shard.lru.clear();
+        }
+        hits_ = 0;
+        misses_ = 0;
     }
 
    private:
-    const Substitutions& subs_;
-    Type* parent_;
-};
+    static const size_t kShards = 16;
 
-void Substitute(const Substitutions& subs, Type& ty) {
-    ApplySubstitution vis(subs, &ty);
-    boost::apply_visitor(vis, ty);
-}
+    ApplyCache() = default;
+    ApplyCache(const ApplyCache&) = delete;
 
-int GetArity(const Type& x) {
-    struct ArityVisitor : public boost::static_visitor<int> {
-        int operator()(const ConstType&) const { return 0; }
-        int operator()(const TypeVar&) const { return 0; }
-        int operator()(const Arrow& a) const {
-            return 1 + boost::apply_visitor(*this, a.rhs());
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            size_t h = key.op * 31 + key.size;
+            for (size_t i = 0; i < key.size; ++i) {
+                h = h * 1000003 ^ key.types[i].hash();
+            }
+            return h;
         }
-    } vis;
-    return boost::apply_visitor(vis, x);
-}
+    };
 
-class Prototype {
-   public:
-    Prototype() = default;
+    struct Shard {
+        std::mutex mutex;
+        // Most recently used first.
+        std::list<std::pair<Key, Type>> lru;
+        std::unordered_map<Key,
+                           std::list<std::pair<Key, Type>>::iterator,
+                           KeyHash>
+            index;
+    };
 
-    Prototype(Prototype&& o) = default;
+    Shard& ShardOf(const Key& key) {
+        // The low bits of the hash are mostly alignment of the nodes.
+        return shards_[(KeyHash()(key) >> 4) % kShards];
+    }
 
-    Prototype(const Prototype& o)
-        : vars_(o.vars_), type_(o.type_), arity_(o.arity_) {}
+    std::atomic<size_t> capacity_{4096};
+    std::atomic<size_t> hits_{0};
+    std::atomic<size_t> misses_{0};
+    Shard shards_[kShards];
+};
 
-    Prototype(Type ty) : type_(std::move(ty)), arity_(GetArity(type_)) {
-        FindVarsVisitor vis;
-        boost::apply_visitor(vis, type_);
-        vars_ = vis.result();
-    }
+class Prototype {
+   public:
+    Prototype() = default;
 
-    Prototype& operator=(const Prototype& o) = default;
-    Prototype& operator=(Prototype&& o) = default;
+    // Every variable of ty is quantified: they are found again from the
+    // type when needed rather than stored.
+    Prototype(Type ty) : type_(ty) {}
 
     std::string Show() const {
         std::string forall;
-        if (!vars_.empty()) {
+        if (!type_.empty() && type_.has_vars()) {
+            TypeVars vars;
+            FindVars(type_, vars);
             forall = "forall";
-            for (int i : vars_) {
+            for (int i : vars) {
                 forall += " " + IdToLetters(i);
             }
             forall += ". ";
@@ -257,15 +546,16 @@ class Prototype {
     }
 
     void Instantiate(Namer& namer) {
-        Substitutions subs;
-        std::set<int> renamed_vars;
-        for (int x : vars_) {
-            int name = namer.NewName();
-            subs[x] = TypeVar(name);
-            renamed_vars.insert(name);
+        if (type_.empty() || !type_.has_vars()) {
+            return;
+        }
+        TypeVars vars;
+        FindVars(type_, vars);
+        int first = namer.NewName();
+        for (size_t i = 1; i < vars.size(); ++i) {
+            namer.NewName();
         }
-        vars_.swap(renamed_vars);
-        Substitute(subs, type_);
+        type_ = Rename(vars, first, type_);
     }
 
     Prototype Substitue(int ty, const Prototype& pro) const {
@@ -277,40 +567,83 @@ class Prototype {
         fun.Instantiate(namer);
         args.Instantiate(namer);
 
-        Substitutions subs;
-        subs[ty] = args.type_;
-        slip::Substitute(subs, fun.type_);
-        return Prototype(std::move(fun.type_));
+        ApplyCache& cache = ApplyCache::Global();
+        ApplyCache::Key key{ty, 2, {fun.type_, args.type_}};
+        Type result;
+        if (!cache.capacity() || !cache.Find(key, &result)) {
+            Substitutions subs;
+            subs.emplace(ty, args.type_);
+            result = slip::Substitute(subs, fun.type_);
+            if (cache.capacity()) {
+                cache.Insert(key, result);
+            }
+        }
+        return Prototype(result);
     }
 
     Prototype Apply(const Prototype& pro) const {
-        Namer namer;
+        return Apply(std::vector<Prototype>{pro});
+    }
 
+    // Applies the function to all of args at once: the call is unified in
+    // one pass, and only the resulting type is rebuilt.
+    Prototype Apply(std::vector<Prototype> args) const {
+        Namer namer;
         Prototype fun = *this;
-        Prototype args = pro;
-
         fun.Instantiate(namer);
-        args.Instantiate(namer);
-
-        auto as_fun = boost::get<Arrow>(&fun.type_);
-        if (!as_fun) {
-            throw std::runtime_error(fun.Show() + " is of non-type function");
+        std::vector<Prototype>& instances = args;
+        for (Prototype& instance : instances) {
+            instance.Instantiate(namer);
         }
 
-        auto subs = Bind(as_fun->lhs(), args.type_);
-        slip::Substitute(subs, as_fun->rhs());
+        // Unifying ground types is only comparing pointers: the cache would
+        // cost more than it saves.
+        bool cached = ApplyCache::Global().capacity() &&
+                      instances.size() <= ApplyCache::kMaxArgs &&
+                      (fun.type_.has_vars() ||
+                       std::any_of(instances.begin(),
+                                   instances.end(),
+                                   [](const Prototype& instance) {
+                                       return instance.type_.has_vars();
+                                   }));
+        ApplyCache::Key key{-1, 0, {}};
+        if (cached) {
+            key.types[key.size++] = fun.type_;
+            for (const Prototype& instance : instances) {
+                key.types[key.size++] = instance.type_;
+            }
+            Type result;
+            if (ApplyCache::Global().Find(key, &result)) {
+                return Prototype(result);
+            }
+        }
 
-        return Prototype(std::move(as_fun->rhs()));
+        Unifier unifier;
+        Type ty = fun.type_;
+        for (const Prototype& instance : instances) {
+            ty = unifier.Find(ty);
+            if (!ty.is_arrow()) {
+                throw std::runtime_error(Prototype(unifier.Resolve(ty)).Show() +
+                                         " is of non-type function");
+            }
+            unifier.Unify(ty.lhs(), instance.type_);
+            ty = ty.rhs();
+        }
+        Type result = unifier.Resolve(ty);
+        if (cached) {
+            ApplyCache::Global().Insert(key, result);
+        }
+        return Prototype(result);
     }
 
-    bool IsFunction() const { return boost::get<Arrow>(&type_) != nullptr; }
+    bool IsFunction() const { return !type_.empty() && type_.is_arrow(); }
+
+    int arity() const { return type_.empty() ? 0 : type_.arity(); }
 
-    int arity() const { return arity_; }
+    Type type() const { return type_; }
 
    private:
-    std::set<int> vars_;
     Type type_;
-    int arity_;
 };
 
 int LowerCaseIdToNbr(const std::string& str) {
@@ -323,39 +656,41 @@ int LowerCaseIdToNbr(const std::string& str) {
 
 template <class P>
 auto Tok2(P p) {
-    return skip_while(parser_pred(parse_char(), isblank)) >> p;
+    return ignore_blank() >> p;
 }
 
-Parser<Type> ParseType() {
-    auto name_to_type = [](const std::string& name) -> Type {
-        if (islower(name[0])) {
-            return TypeVar(LowerCaseIdToNbr(name));
-        }
-        return ConstType(name);
-    };
+// type := (word | '(' type ')') ['->' type]
+struct TypeGrammar {
+    template <class Self>
+    static auto build(Self self) {
+        auto name_to_type = [](const std::string& name) -> Type {
+            if (islower(name[0])) {
+                return TypeVar(LowerCaseIdToNbr(name));
+            }
+            return ConstType(name);
+        };
+
+        auto atom_type = Tok2(parse_word()) % name_to_type;
+        auto paren = Tok2(parse_char('(')) >> self << Tok2(parse_char(')'));
+        auto arrow = Tok2(parse_char('-')) >> parse_char('>');
+        return ((atom_type | paren) & !(arrow >> self)) %
+               [](auto&& x) -> Type {
+                   if (!x.second) {
+                       return x.first;
+                   }
+                   return Arrow(x.first, *x.second);
+               };
+    }
+};
 
-    auto atom_type = Tok2(parse_word()) % name_to_type;
-    auto paren = [](auto&& fun) {
-        return Tok2(parse_char('(')) >> fun << Tok2(parse_char(')'));
-    };
-    auto arrow = Tok2(parse_char('-')) >> parse_char('>');
-    Parser<Type> fun =
-        ((atom_type | paren(recursion(fun))) & !(arrow >> recursion(fun))) %
-        [](auto&& x) -> Type {
-        if (!x.second) {
-            return std::move(x.first);
-        }
-        return Arrow(std::move(x.first), std::move(*x.second));
-    };
-    return fun;
-}
+auto ParseType() { return rule<Type, TypeGrammar>(); }
 
-auto ParseType(const std::string& input) {
+auto ParseType(boost::string_view input) {
     static const auto parser = ParseType();
-    auto res = parser(input.begin(), input.end());
+    auto res = parser(input.data(), input.data() + input.size());
     if (!res) {
-        return Prototype();
+        throw std::runtime_error("bad type: " + input.to_string());
     }
-    return Prototype(std::move(res->first));
+    return Prototype(res->first);
 }
 }  // namespace slip
@@ -2,58 +2,365 @@
 
 #include "ast.h"
 #include "context.h"
+#include "flat-ast.h"
 #include "function.h"
 #include "mangler.h"
+#include "typed-ast.h"
 
+#include <algorithm>
 #include <map>
 #include <string>
+#include <vector>
 
 namespace slip {
-class TypeChecker : public boost::static_visitor<Prototype> {
-    Context& ctx_;
+namespace {
+// Types of literals, built once rather than at every node.
+const Prototype& IntType() {
+    static const Prototype type(ConstType("Int"));
+    return type;
+}
+const Prototype& BoolType() {
+    static const Prototype type(ConstType("Bool"));
+    return type;
+}
+const Prototype& StringType() {
+    static const Prototype type(ConstType("String"));
+    return type;
+}
+const Prototype& VoidType() {
+    static const Prototype type(ConstType("Void"));
+    return type;
+}
 
-    Prototype GetFunctionType(const List& xs) {
-        const std::string* fun_name = xs.GetFunName();
-        if (fun_name) {
-            auto found = ctx_.Find(*fun_name);
-            if (!found) {
-                throw std::runtime_error("Can't find function " + *fun_name);
+size_t NodeCount(const Val& x) {
+    const List* xs = boost::get<List>(&x);
+    if (!xs) {
+        return 1;
+    }
+    size_t count = 1;
+    for (const Val& y : *xs) {
+        count += NodeCount(y);
+    }
+    return count;
+}
+}  // namespace
+
+// Whether fun may take args, judging only from the arguments whose type and
+// parameter are both ground.
+bool MayAccept(Type fun, const std::vector<Prototype>& args) {
+    for (const Prototype& arg : args) {
+        if (!fun.is_arrow()) {
+            return fun.has_vars();
+        }
+        Type param = fun.lhs();
+        if (!param.has_vars() && !arg.type().has_vars() &&
+            param != arg.type()) {
+            return false;
+        }
+        fun = fun.rhs();
+    }
+    return true;
+}
+
+// The overload of the function named by symbol that a call with args is bound
+// to. Only names with several functions need resolving, and only overloads
+// left by MayAccept() are tried. When several fit, as without args in
+// (const (+)) or with args of types not known yet, it is the one declared
+// first.
+int ResolveOverload(Context& ctx,
+                    int symbol,
+                    const std::vector<Prototype>& args) {
+    const std::string& name = SymbolTable::Global().Name(symbol);
+    const auto& overloads = ctx.Overloads(symbol);
+    if (overloads.empty()) {
+        throw std::runtime_error("Can't find function " + name);
+    }
+    if (overloads.size() == 1 || args.empty()) {
+        return 0;
+    }
+    std::vector<int> candidates;
+    for (size_t i = 0; i < overloads.size(); ++i) {
+        if (MayAccept(overloads[i]->type().type(), args)) {
+            candidates.push_back(i);
+        }
+    }
+    for (int i : candidates) {
+        if (candidates.size() > 1) {
+            try {
+                overloads[i]->type().Apply(args);
+            } catch (std::runtime_error&) {
+                continue;
             }
-            return found->type();
-        } else {
-            return boost::apply_visitor(*this, xs[0]);
         }
+        return i;
     }
+    std::string types;
+    for (const Prototype& arg : args) {
+        types += (types.empty() ? "" : ", ") + arg.Show();
+    }
+    throw std::runtime_error("no overload of " + name + " takes " + types);
+}
+
+class TypeChecker : public boost::static_visitor<Prototype> {
+    Context& ctx_;
 
    public:
     TypeChecker(Context& ctx) : ctx_(ctx) {}
 
-    Prototype operator()(const Int&) { return Prototype(ConstType("Int")); }
-    Prototype operator()(const Bool&) { return Prototype(ConstType("Bool")); }
+    Prototype operator()(const Int&) { return IntType(); }
+    Prototype operator()(const Bool&) { return BoolType(); }
     Prototype operator()(const Atom&) {
         throw std::runtime_error("not implemented yet");
     }
-    Prototype operator()(const Str&) { return Prototype(ConstType("String")); }
+    Prototype operator()(const Str&) { return StringType(); }
     Prototype operator()(const List& xs) {
         if (xs.empty()) {
-            return Prototype(ConstType("Void"));
+            return VoidType();
         }
 
-        Prototype ret_type = GetFunctionType(xs);
+        const Atom* fun_name = xs.GetFunAtom();
+        Prototype ret_type;
+        if (!fun_name) {
+            ret_type = boost::apply_visitor(*this, xs[0]);
+        }
+        std::vector<Prototype> args;
+        args.reserve(xs.size() - 1);
         for (size_t i = 1; i < xs.size(); ++i) {
-            ret_type = ret_type.Apply(boost::apply_visitor(*this, xs[i]));
+            args.push_back(boost::apply_visitor(*this, xs[i]));
         }
-        return ret_type;
+        if (fun_name) {
+            int overload = ResolveOverload(ctx_, fun_name->symbol(), args);
+            fun_name->Bind(overload);
+            ret_type = ctx_.Find(fun_name->symbol(), overload)->type();
+        }
+        if (args.empty()) {
+            return ret_type;
+        }
+        return ret_type.Apply(std::move(args));
     }
 };
 
-void TypeCheck(Val& x, Context& ctx) {
-    TypeChecker tc(ctx);
-    boost::apply_visitor(tc, x);
+// The index N of a placeholder ?N, or -1 for any other atom.
+int PlaceholderIndex(const Atom& x) {
+    const std::string& name = x.val();
+    if (name.size() < 2 || name[0] != '?' ||
+        !std::all_of(name.begin() + 1, name.end(), [](char c) {
+            return c >= '0' && c <= '9';
+        })) {
+        return -1;
+    }
+    return std::stoi(name.substr(1));
+}
+
+// Types a tree like TypeChecker, keeping the result for every node in a
+// TypedAst. Placeholders are typed from params, when given.
+class Annotator : public boost::static_visitor<Prototype> {
+    using Kind = TypedAst::Kind;
+
+    Context& ctx_;
+    std::vector<TypedAst::Node>& nodes_;
+    const std::vector<Type>* params_;
+
+   public:
+    Annotator(Context& ctx,
+              TypedAst& ast,
+              const std::vector<Type>* params = nullptr)
+        : ctx_(ctx), nodes_(ast.nodes_), params_(params) {}
+
+    void Reserve(size_t nodes) { nodes_.reserve(nodes); }
+
+    Prototype Annotate(const Val& x) {
+        uint32_t idx = nodes_.size();
+        nodes_.push_back(
+            {Kind::Int, false, 0, 0, 0, -1, &x, nullptr, Type()});
+        Prototype type = boost::apply_visitor(*this, x);
+        nodes_[idx].span = nodes_.size() - idx;
+        nodes_[idx].type = type.type();
+        for (uint32_t i = idx + 1; i < nodes_.size(); i += nodes_[i].span) {
+            nodes_[idx].has_params |= nodes_[i].has_params;
+        }
+        return type;
+    }
+
+    Prototype operator()(const Int& x) {
+        nodes_.back().value = x.val();
+        return IntType();
+    }
+    Prototype operator()(const Bool& x) {
+        nodes_.back().kind = Kind::Bool;
+        nodes_.back().value = x.val();
+        return BoolType();
+    }
+    Prototype operator()(const Atom& x) {
+        int param = PlaceholderIndex(x);
+        if (!params_ || param < 0 ||
+            static_cast<size_t>(param) >= params_->size()) {
+            throw std::runtime_error("not implemented yet");
+        }
+        nodes_.back().kind = Kind::Param;
+        nodes_.back().has_params = true;
+        nodes_.back().value = param;
+        return Prototype((*params_)[param]);
+    }
+    Prototype operator()(const Str&) {
+        nodes_.back().kind = Kind::Str;
+        return StringType();
+    }
+    Prototype operator()(const List& xs) {
+        uint32_t idx = nodes_.size() - 1;
+        nodes_[idx].kind = Kind::List;
+        nodes_[idx].size = xs.size();
+        if (xs.empty()) {
+            return VoidType();
+        }
+
+        const Atom* fun_name = xs.GetFunAtom();
+        uint32_t head = nodes_.size();
+        Prototype ret_type;
+        if (fun_name) {
+            // Filled once the overload is known.
+            nodes_.push_back({Kind::Atom,
+                              false,
+                              0,
+                              0,
+                              1,
+                              -1,
+                              &xs[0],
+                              nullptr,
+                              Type()});
+        } else {
+            ret_type = Annotate(xs[0]);
+        }
+        std::vector<Prototype> args;
+        args.reserve(xs.size() - 1);
+        for (size_t i = 1; i < xs.size(); ++i) {
+            args.push_back(Annotate(xs[i]));
+        }
+        if (fun_name) {
+            int overload = ResolveOverload(ctx_, fun_name->symbol(), args);
+            fun_name->Bind(overload);
+            Function* found = ctx_.Find(fun_name->symbol(), overload);
+            ret_type = found->type();
+            nodes_[idx].arity = found->arity();
+            nodes_[head].fun = found;
+            nodes_[head].type = ret_type.type();
+        }
+        if (args.empty()) {
+            return ret_type;
+        }
+        return ret_type.Apply(std::move(args));
+    }
+};
+
+// Typechecks x and records, for every node, its type and the function it
+// calls, for Eval() to trust instead of checking again. x must outlive the
+// result. params are the types of placeholders, see PreparedScript.
+TypedAst Annotate(const Val& x,
+                  Context& ctx,
+                  const std::vector<Type>* params = nullptr) {
+    TypedAst ast;
+    Annotator annotator(ctx, ast, params);
+    annotator.Reserve(NodeCount(x));
+    annotator.Annotate(x);
+    return ast;
 }
 
+// Scripts already checked in ctx are looked up in its TypeCache instead.
 Prototype TypeExpression(const Val& x, Context& ctx) {
+    TypeCache& cache = ctx.type_cache();
+    if (!cache.capacity()) {
+        TypeChecker tc(ctx);
+        return boost::apply_visitor(tc, x);
+    }
+    size_t hash = StructuralHash(x);
+    Type result;
+    if (cache.Find(x, hash, &result)) {
+        return Prototype(result);
+    }
     TypeChecker tc(ctx);
-    return boost::apply_visitor(tc, x);
+    Prototype type = boost::apply_visitor(tc, x);
+    cache.Insert(x, hash, type.type());
+    return type;
 }
+
+void TypeCheck(Val& x, Context& ctx) { TypeExpression(x, ctx); }
+
+namespace {
+struct Linker : public boost::static_visitor<> {
+    Context& ctx;
+
+    explicit Linker(Context& ctx) : ctx(ctx) {}
+
+    void operator()(const Atom& x) const {
+        x.Link(ctx.Find(x.symbol(), x.overload()), ctx.stamp());
+    }
+    void operator()(const List& xs) const {
+        for (auto& x : xs) {
+            boost::apply_visitor(*this, x);
+        }
+    }
+    template <class T>
+    void operator()(const T&) const {}
+};
+}  // namespace
+
+// Stores in every atom of a type checked tree the function it was bound to,
+// for evaluation not to look it up anymore. Evaluating the tree in another
+// Context, or after a function was declared in ctx, looks functions up again
+// instead; type checking it again unlinks it.
+void Link(const Val& x, Context& ctx) {
+    boost::apply_visitor(Linker(ctx), x);
+}
+
+Prototype TypeExpression(FlatVal x, Context& ctx) {
+    switch (x.kind()) {
+        case FlatVal::Kind::Int:
+            return IntType();
+        case FlatVal::Kind::Bool:
+            return BoolType();
+        case FlatVal::Kind::Atom:
+            throw std::runtime_error("not implemented yet");
+        case FlatVal::Kind::Str:
+            return StringType();
+        case FlatVal::Kind::List:
+            break;
+    }
+
+    if (x.empty()) {
+        return VoidType();
+    }
+
+    auto it = x.begin();
+    FlatVal head = *it;
+    bool named = head.kind() == FlatVal::Kind::Atom;
+    Prototype ret_type;
+    if (!named) {
+        ret_type = TypeExpression(head, ctx);
+    }
+    std::vector<Prototype> args;
+    args.reserve(x.size() - 1);
+    for (++it; it != x.end(); ++it) {
+        args.push_back(TypeExpression(*it, ctx));
+    }
+    if (named) {
+        int overload = ResolveOverload(ctx, head.symbol(), args);
+        head.Bind(overload);
+        Function* fun = ctx.Find(head.symbol(), overload);
+        ret_type = fun->type();
+        // Its arguments reach it as trees, made now rather than by each
+        // evaluation.
+        if (fun->special()) {
+            auto arg = x.begin();
+            for (++arg; arg != x.end(); ++arg) {
+                x.ast().Materialize((*arg).index());
+            }
+        }
+    }
+    if (args.empty()) {
+        return ret_type;
+    }
+    return ret_type.Apply(std::move(args));
+}
+
+void TypeCheck(FlatVal x, Context& ctx) { TypeExpression(x, ctx); }
 }  // namespace slip
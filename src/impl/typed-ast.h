@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ast.h"
+#include "polymorphic.h"
+#include "type.h"
+
+namespace slip {
+class Function;
+class TypedVal;
+
+// A Val along with what the type checker found out about it, see Annotate().
+// Nodes are stored in preorder like those of a FlatAst, and point back to the
+// Val they annotate, which must outlive them.
+class TypedAst {
+   public:
+    // Param: a placeholder of a PreparedScript.
+    enum class Kind : uint8_t { Int, Bool, Atom, Str, List, Param };
+
+    struct Node {
+        Kind kind;
+        // Whether a Param is in this subtree.
+        bool has_params;
+        // Int and Bool: the value. Param: its index.
+        int32_t value;
+        // List: number of children, the head included.
+        uint32_t size;
+        // How many nodes this subtree has, itself included: the next sibling
+        // is that many nodes further.
+        uint32_t span;
+        // List whose head is an atom: how many arguments the closure of the
+        // function takes. -1 otherwise.
+        int32_t arity;
+        const Val* val;
+        // Atom: the function it names.
+        Function* fun;
+        // The type of the expression, with its variables resolved.
+        Type type;
+    };
+
+    TypedVal root() const;
+
+    size_t node_count() const { return nodes_.size(); }
+    const Node& node(uint32_t i) const { return nodes_[i]; }
+    // One past the last node of the subtree at i.
+    uint32_t end(uint32_t i) const { return i + nodes_[i].span; }
+
+   private:
+    friend class Annotator;
+
+    std::vector<Node> nodes_;
+};
+
+// A node of a TypedAst, cheap to copy around: it is two pointers, for it to
+// be passed in registers through the calls of Eval() and Closure::Apply().
+class TypedVal {
+   public:
+    using Kind = TypedAst::Kind;
+    using Node = TypedAst::Node;
+
+    class iterator {
+       public:
+        iterator(const Node* node, const Polymorphic* params)
+            : node_(node), params_(params) {}
+        TypedVal operator*() const { return TypedVal(node_, params_); }
+        iterator& operator++() {
+            node_ += node_->span;
+            return *this;
+        }
+        bool operator!=(const iterator& o) const { return node_ != o.node_; }
+
+       private:
+        const Node* node_;
+        const Polymorphic* params_;
+    };
+
+    // params are the values bound to the placeholders, if any.
+    TypedVal(const TypedAst* ast,
+             uint32_t idx,
+             const Polymorphic* params = nullptr)
+        : TypedVal(&ast->node(idx), params) {}
+    TypedVal(const Node* node, const Polymorphic* params)
+        : node_(node), params_(params) {}
+
+    Kind kind() const { return node_->kind; }
+    int int_val() const { return node_->value; }
+    bool bool_val() const { return node_->value; }
+    const Val& val() const { return *node_->val; }
+    Function* function() const { return node_->fun; }
+    int arity() const { return node_->arity; }
+    Type type() const { return node_->type; }
+    bool has_params() const { return node_->has_params; }
+    // Param: the value bound to it, of the type of the node.
+    const Polymorphic& param() const { return params_[node_->value]; }
+
+    // A tree with the bound values in place of the placeholders, for what
+    // only takes a Val.
+    Val Bound() const;
+
+    // List accessors.
+    bool empty() const { return node_->size == 0; }
+    size_t size() const { return node_->size; }
+    iterator begin() const { return iterator(node_ + 1, params_); }
+    iterator end() const { return iterator(node_ + node_->span, params_); }
+    TypedVal head() const { return TypedVal(node_ + 1, params_); }
+
+   private:
+    const Node* node_;
+    const Polymorphic* params_;
+};
+
+TypedVal TypedAst::root() const { return TypedVal(this, 0); }
+
+Val TypedVal::Bound() const {
+    if (!has_params()) {
+        return val();
+    }
+    if (kind() == Kind::Param) {
+        if (const int* i = param().as<int*>()) {
+            return Int(*i);
+        }
+        if (const bool* b = param().as<bool*>()) {
+            return Bool(*b);
+        }
+        return Str(param().as<std::string>());
+    }
+    std::vector<Val> vals;
+    vals.reserve(size());
+    for (TypedVal x : *this) {
+        vals.push_back(x.Bound());
+    }
+    return List(std::move(vals));
+}
+}  // namespace slip
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/utility/string_view.hpp>
+
+#include "ast.h"
+#include "flat-ast.h"
+#include "rd-parser.h"
+#include "script.h"
+
+namespace slip {
+// A compact binary encoding of a Val, for clients that send pre-parsed
+// scripts. Integers are LEB128 varints, signed ones zigzag encoded.
+//
+//   wire   := version atom_count atom* node
+//   atom   := length bytes
+//   node   := Int zigzag | False | True | Str length bytes | Atom index
+//           | List count node*
+//
+// Each distinct atom name is written once, and nodes refer to it by its
+// index in the table.
+namespace wire {
+enum class Tag : uint8_t { Int, False, True, Str, Atom, List };
+
+const uint8_t kVersion = 1;
+
+inline void PutVarint(std::string& out, uint32_t x) {
+    while (x >= 0x80) {
+        out.push_back(static_cast<char>(x | 0x80));
+        x >>= 7;
+    }
+    out.push_back(static_cast<char>(x));
+}
+
+inline void PutTag(std::string& out, Tag tag) {
+    out.push_back(static_cast<char>(tag));
+}
+
+inline uint32_t Zigzag(int32_t x) {
+    return (static_cast<uint32_t>(x) << 1) ^ static_cast<uint32_t>(x >> 31);
+}
+
+inline int32_t Unzigzag(uint32_t x) {
+    return static_cast<int32_t>(x >> 1) ^ -static_cast<int32_t>(x & 1);
+}
+
+class WriteVisitor : public boost::static_visitor<> {
+   public:
+    explicit WriteVisitor(std::string& out) : out_(out) {}
+
+    void operator()(const slip::Int& x) {
+        PutTag(out_, Tag::Int);
+        PutVarint(out_, Zigzag(x.val()));
+    }
+    void operator()(const slip::Bool& x) {
+        PutTag(out_, x.val() ? Tag::True : Tag::False);
+    }
+    void operator()(const slip::Atom& x) {
+        PutTag(out_, Tag::Atom);
+        PutVarint(out_, AtomIndex(x.symbol()));
+    }
+    void operator()(const slip::Str& x) {
+        PutTag(out_, Tag::Str);
+        PutVarint(out_, x.view().size());
+        out_.append(x.view().data(), x.view().size());
+    }
+    void operator()(const slip::List& xs) {
+        PutTag(out_, Tag::List);
+        PutVarint(out_, xs.size());
+        for (auto& x : xs) {
+            boost::apply_visitor(*this, x);
+        }
+    }
+
+    // Symbols of the atoms, in order of first appearance.
+    const std::vector<int>& atoms() const { return atoms_; }
+
+   private:
+    uint32_t AtomIndex(int symbol) {
+        if (static_cast<size_t>(symbol) >= indices_.size()) {
+            indices_.resize(symbol + 1, -1);
+        }
+        if (indices_[symbol] < 0) {
+            indices_[symbol] = atoms_.size();
+            atoms_.push_back(symbol);
+        }
+        return indices_[symbol];
+    }
+
+    std::string& out_;
+    std::vector<int> atoms_;
+    // By symbol: index in atoms_, or -1.
+    std::vector<int> indices_;
+};
+
+// Decodes one encoded Val into a Builder, the same ones as RDParser's, which
+// also have to handle AddSymbol(int). Like RDParser, nesting is tracked
+// without recursing.
+template <class Builder>
+class Reader {
+   public:
+    Reader(const char* begin, const char* end, Builder& builder)
+        : cur_(reinterpret_cast<const uint8_t*>(begin)),
+          end_(reinterpret_cast<const uint8_t*>(end)),
+          builder_(builder) {}
+
+    // Fails on malformed input, or if anything follows the encoded Val.
+    bool Read() {
+        uint32_t atom_count;
+        if (cur_ == end_ || *cur_++ != kVersion || !Varint(&atom_count)) {
+            return false;
+        }
+        // Every atom takes at least a byte, whatever the count claims.
+        symbols_.reserve(std::min<size_t>(atom_count, end_ - cur_));
+        for (uint32_t i = 0; i < atom_count; ++i) {
+            const char* b;
+            const char* e;
+            if (!Bytes(&b, &e)) {
+                return false;
+            }
+            symbols_.push_back(
+                SymbolTable::Global().Intern(boost::string_view(b, e - b)));
+        }
+
+        // Children left to read in each list still open, innermost last.
+        std::vector<uint32_t> left;
+        do {
+            if (!left.empty()) {
+                --left.back();
+            }
+            if (cur_ == end_) {
+                return false;
+            }
+            uint32_t x;
+            const char* b;
+            const char* e;
+            switch (static_cast<Tag>(*cur_++)) {
+                case Tag::Int:
+                    if (!Varint(&x)) {
+                        return false;
+                    }
+                    builder_.AddInt(Unzigzag(x));
+                    break;
+                case Tag::False:
+                    builder_.AddBool(false);
+                    break;
+                case Tag::True:
+                    builder_.AddBool(true);
+                    break;
+                case Tag::Str:
+                    if (!Bytes(&b, &e)) {
+                        return false;
+                    }
+                    builder_.AddStr(b, e);
+                    break;
+                case Tag::Atom:
+                    if (!Varint(&x) || x >= symbols_.size()) {
+                        return false;
+                    }
+                    builder_.AddSymbol(symbols_[x]);
+                    break;
+                case Tag::List:
+                    if (!Varint(&x)) {
+                        return false;
+                    }
+                    builder_.OpenList();
+                    left.push_back(x);
+                    break;
+                default:
+                    return false;
+            }
+            while (!left.empty() && left.back() == 0) {
+                left.pop_back();
+                builder_.CloseList();
+            }
+        } while (!left.empty());
+        return cur_ == end_;
+    }
+
+   private:
+    bool Varint(uint32_t* x) {
+        *x = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            if (cur_ == end_) {
+                return false;
+            }
+            uint8_t byte = *cur_++;
+            // The fifth byte only has the top 4 bits left, and is the last.
+            if (shift == 28 && byte > 0x0F) {
+                return false;
+            }
+            *x |= static_cast<uint32_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool Bytes(const char** b, const char** e) {
+        uint32_t size;
+        if (!Varint(&size) || static_cast<size_t>(end_ - cur_) < size) {
+            return false;
+        }
+        *b = reinterpret_cast<const char*>(cur_);
+        cur_ += size;
+        *e = reinterpret_cast<const char*>(cur_);
+        return true;
+    }
+
+    const uint8_t* cur_;
+    const uint8_t* end_;
+    Builder& builder_;
+    // Atom table of the input.
+    std::vector<int> symbols_;
+};
+}  // namespace wire
+
+std::string Serialize(const Val& v) {
+    std::string body;
+    wire::WriteVisitor writer(body);
+    boost::apply_visitor(writer, v);
+
+    std::string out;
+    out.push_back(wire::kVersion);
+    wire::PutVarint(out, writer.atoms().size());
+    for (int symbol : writer.atoms()) {
+        const std::string& name = SymbolTable::Global().Name(symbol);
+        wire::PutVarint(out, name.size());
+        out += name;
+    }
+    return out + body;
+}
+
+// Decodes a Val that owns its strings.
+optional<Val> Deserialize(boost::string_view input) {
+    ValBuilder builder;
+    wire::Reader<ValBuilder> reader(
+        input.data(), input.data() + input.size(), builder);
+    if (!reader.Read()) {
+        return optional<Val>();
+    }
+    return make_optional(std::move(builder.result()));
+}
+
+// Decodes without copying: string literals are views into buffer, as with
+// ParseScript().
+template <class Buffer>
+optional<Script> DeserializeScript(std::shared_ptr<const Buffer> buffer) {
+    ValBuilder builder(/* borrow_strings = */ true);
+    wire::Reader<ValBuilder> reader(
+        buffer->data(), buffer->data() + buffer->size(), builder);
+    if (!reader.Read()) {
+        return optional<Script>();
+    }
+    return make_optional(
+        Script(std::move(buffer), std::move(builder.result())));
+}
+
+optional<FlatAst> DeserializeFlat(boost::string_view input) {
+    FlatAst ast;
+    FlatBuilder builder(ast);
+    wire::Reader<FlatBuilder> reader(
+        input.data(), input.data() + input.size(), builder);
+    if (!reader.Read()) {
+        return optional<FlatAst>();
+    }
+    return make_optional(std::move(ast));
+}
+}  // namespace slip
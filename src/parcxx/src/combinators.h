@@ -3,11 +3,15 @@
 #include "optional.h"
 
 #include <functional>
+#include <memory>
 #include <string>
 #include <tuple>
+#include <unordered_map>
 #include <vector>
 
-typedef std::string::const_iterator str_iterator;
+// Parsers read any contiguous range of chars: a std::string, a string view,
+// a network buffer or a mapped file, without copying it first.
+typedef const char* str_iterator;
 
 template <class F>
 class ParserImpl {
@@ -29,10 +33,18 @@ class ParserImpl {
     decltype(auto) operator()(str_iterator begin, str_iterator end) const {
         return fun_(begin, end);
     }
+
+    // A std::string range is parsed in place. What remains of the input is
+    // returned as a pointer into the string.
+    decltype(auto) operator()(std::string::const_iterator begin,
+                              std::string::const_iterator end) const {
+        const char* b = begin == end ? nullptr : &*begin;
+        return fun_(b, b + (end - begin));
+    }
 };
 
 template <class T>
-using ParserRet = optional<std::pair<T, std::string::const_iterator>>;
+using ParserRet = optional<std::pair<T, str_iterator>>;
 
 template <class T>
 using Parser =
@@ -362,3 +374,78 @@ auto list_of1(P&& p) {
         return make_optional(std::make_pair(std::move(vec), res->second));
     });
 };
+
+// Packrat parsing. Within a packrat(p) call, every memo(q) parser remembers
+// its result at each position it was tried at, so that alternatives and
+// recursive rules that come back to the same position don't parse it again.
+// That makes the parse linear in the input, at the cost of keeping every
+// result. Outside of packrat(), memo(q) is just q. Results are keyed on
+// their offset from where packrat() started, so memoized parsers must be
+// called with the same end. Left recursion still doesn't terminate.
+class PackratTable {
+   public:
+    explicit PackratTable(str_iterator begin) : begin_(begin) {}
+
+    template <class R>
+    std::unordered_map<size_t, R>& results(const void* parser_id) {
+        auto& res = tables_[parser_id];
+        if (!res) {
+            res.reset(new Results<R>());
+        }
+        return static_cast<Results<R>&>(*res).results;
+    }
+
+    size_t offset(str_iterator it) const { return it - begin_; }
+
+    static PackratTable*& current() {
+        static thread_local PackratTable* table = nullptr;
+        return table;
+    }
+
+   private:
+    struct ResultsBase {
+        virtual ~ResultsBase() = default;
+    };
+
+    template <class R>
+    struct Results : public ResultsBase {
+        std::unordered_map<size_t, R> results;
+    };
+
+    str_iterator begin_;
+    std::unordered_map<const void*, std::unique_ptr<ResultsBase>> tables_;
+};
+
+template <class P>
+auto memo(P p) {
+    // Copies of this parser share the same id, and so the same results.
+    auto id = std::make_shared<char>();
+    return make_parser([p, id](str_iterator begin, str_iterator end) {
+        PackratTable* table = PackratTable::current();
+        if (!table) {
+            return p(begin, end);
+        }
+        auto& results = table->results<decltype(p(begin, end))>(id.get());
+        size_t pos = table->offset(begin);
+        auto found = results.find(pos);
+        if (found != results.end()) {
+            return found->second;
+        }
+        auto res = p(begin, end);
+        results.emplace(pos, res);
+        return res;
+    });
+}
+
+template <class P>
+auto packrat(P p) {
+    return make_parser([p](str_iterator begin, str_iterator end) {
+        PackratTable table(begin);
+        struct Scope {
+            PackratTable* saved;
+            ~Scope() { PackratTable::current() = saved; }
+        } scope{PackratTable::current()};
+        PackratTable::current() = &table;
+        return p(begin, end);
+    });
+}
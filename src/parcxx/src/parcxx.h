@@ -1,6 +1,7 @@
 #pragma once
 
 #include "combinators.h"
+#include "scan.h"
 
 #include <functional>
 
@@ -10,15 +11,26 @@ auto parse_digit() {
 }
 
 auto parse_uint() {
-    return parse_while1(
-        parse_digit(), 0, [](int a, int b) -> int { return a * 10 + b; });
+    return make_parser([](str_iterator begin, str_iterator end) {
+        auto digits_end = scan_digits(begin, end);
+        if (digits_end == begin) {
+            return ParserRet<int>();
+        }
+        return make_optional(std::make_pair(
+            static_cast<int>(digits_value(begin, digits_end)), digits_end));
+    });
 }
 
 auto ignore_whitespaces() {
     return skip_while(parser_pred(parse_char(), isspace));
 }
 
-auto ignore_blank() { return skip_while(parser_pred(parse_char(), isblank)); }
+auto ignore_blank() {
+    return make_parser([](str_iterator begin, str_iterator end) {
+        return make_optional(
+            std::make_pair(Empty(), scan_blanks(begin, end)));
+    });
+}
 
 auto parse_int() {
     return !parser_pred(parse_char(), [](char c) { return c == '-'; }) >>=
@@ -50,3 +62,61 @@ auto recursion(P& p) {
     return make_parser(
         [&](str_iterator begin, str_iterator end) { return p(begin, end); });
 }
+
+// A non-owning, type erased reference to a parser returning T: the address
+// of the parser and of a function calling it. Unlike Parser<T>, making one
+// never copies the parser to the heap, but the parser must outlive it.
+template <class T>
+class ParserFnRef {
+   public:
+    template <class F>
+    explicit ParserFnRef(const F& f) : obj_(&f), call_(&Call<F>) {}
+
+    ParserRet<T> operator()(str_iterator begin, str_iterator end) const {
+        return call_(obj_, begin, end);
+    }
+
+   private:
+    template <class F>
+    static ParserRet<T> Call(const void* obj,
+                             str_iterator begin,
+                             str_iterator end) {
+        return (*static_cast<const F*>(obj))(begin, end);
+    }
+
+    const void* obj_;
+    ParserRet<T> (*call_)(const void*, str_iterator, str_iterator);
+};
+
+template <class T>
+using ParserRef = ParserImpl<ParserFnRef<T>>;
+
+template <class F>
+auto parser_ref(const ParserImpl<F>& p) {
+    using T = std::decay_t<decltype(p(str_iterator(), str_iterator())->first)>;
+    return ParserRef<T>(ParserFnRef<T>(p));
+}
+
+// A statically typed recursive grammar. Def::build(self) returns the grammar,
+// self being a parser that calls the grammar back. The grammar is built once,
+// on first use, and nothing is type erased: recursive calls are plain calls
+// that the compiler can inline, and copying the rule copies an empty object.
+// T is the result type, which can't be deduced from the grammar itself.
+template <class T, class Def>
+class RuleImpl {
+   public:
+    ParserRet<T> operator()(str_iterator begin, str_iterator end) const {
+        return grammar()(begin, end);
+    }
+
+   private:
+    static const auto& grammar() {
+        static const auto g = Def::build(ParserImpl<RuleImpl>(RuleImpl()));
+        return g;
+    }
+};
+
+template <class T, class Def>
+auto rule() {
+    return ParserImpl<RuleImpl<T, Def>>(RuleImpl<T, Def>());
+}
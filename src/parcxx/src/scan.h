@@ -0,0 +1,160 @@
+#pragma once
+
+#include <string>
+
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Vectorized scanners for the runs of characters that make up most tokens.
+// They look at 32 (AVX2) or 16 (SSE2) bytes at a time and fall back to a
+// plain loop on the tail, or everywhere when neither is enabled. Character
+// classes are those of the "C" locale.
+namespace scan_detail {
+struct Blank {
+    static bool scalar(char c) { return c == ' ' || c == '\t'; }
+#ifdef __SSE2__
+    static __m128i vec(__m128i x) {
+        return _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                            _mm_cmpeq_epi8(x, _mm_set1_epi8('\t')));
+    }
+#endif
+#ifdef __AVX2__
+    static __m256i vec(__m256i x) {
+        return _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                               _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t')));
+    }
+#endif
+};
+
+struct Digit {
+    static bool scalar(char c) { return c >= '0' && c <= '9'; }
+#ifdef __SSE2__
+    static __m128i vec(__m128i x) {
+        __m128i d = _mm_sub_epi8(x, _mm_set1_epi8('0'));
+        return _mm_and_si128(_mm_cmpgt_epi8(d, _mm_set1_epi8(-1)),
+                             _mm_cmplt_epi8(d, _mm_set1_epi8(10)));
+    }
+#endif
+#ifdef __AVX2__
+    static __m256i vec(__m256i x) {
+        __m256i d = _mm256_sub_epi8(x, _mm256_set1_epi8('0'));
+        return _mm256_and_si256(_mm256_cmpgt_epi8(d, _mm256_set1_epi8(-1)),
+                                _mm256_cmpgt_epi8(_mm256_set1_epi8(10), d));
+    }
+#endif
+};
+
+// isspace(), or a paren: what ends an atom.
+struct AtomEnd {
+    static bool scalar(char c) {
+        return c == ' ' || (c >= '\t' && c <= '\r') || c == '(' || c == ')';
+    }
+#ifdef __SSE2__
+    static __m128i vec(__m128i x) {
+        // '\t' to '\r' is a range of 5.
+        __m128i ctrl = _mm_sub_epi8(x, _mm_set1_epi8('\t'));
+        ctrl = _mm_and_si128(_mm_cmpgt_epi8(ctrl, _mm_set1_epi8(-1)),
+                             _mm_cmplt_epi8(ctrl, _mm_set1_epi8(5)));
+        __m128i other = _mm_or_si128(
+            _mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+            _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('(')),
+                         _mm_cmpeq_epi8(x, _mm_set1_epi8(')'))));
+        return _mm_or_si128(ctrl, other);
+    }
+#endif
+#ifdef __AVX2__
+    static __m256i vec(__m256i x) {
+        __m256i ctrl = _mm256_sub_epi8(x, _mm256_set1_epi8('\t'));
+        ctrl = _mm256_and_si256(_mm256_cmpgt_epi8(ctrl, _mm256_set1_epi8(-1)),
+                                _mm256_cmpgt_epi8(_mm256_set1_epi8(5), ctrl));
+        __m256i other = _mm256_or_si256(
+            _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+            _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('(')),
+                            _mm256_cmpeq_epi8(x, _mm256_set1_epi8(')'))));
+        return _mm256_or_si256(ctrl, other);
+    }
+#endif
+};
+
+template <char C>
+struct Is {
+    static bool scalar(char c) { return c == C; }
+#ifdef __SSE2__
+    static __m128i vec(__m128i x) {
+        return _mm_cmpeq_epi8(x, _mm_set1_epi8(C));
+    }
+#endif
+#ifdef __AVX2__
+    static __m256i vec(__m256i x) {
+        return _mm256_cmpeq_epi8(x, _mm256_set1_epi8(C));
+    }
+#endif
+};
+
+// Returns the first position in [begin, end) whose membership in Class is
+// Member, or end.
+template <class Class, bool Member>
+const char* scan(const char* begin, const char* end) {
+#ifdef __AVX2__
+    while (end - begin >= 32) {
+        unsigned mask = _mm256_movemask_epi8(Class::vec(_mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(begin))));
+        if (!Member) {
+            mask = ~mask;
+        }
+        if (mask) {
+            return begin + __builtin_ctz(mask);
+        }
+        begin += 32;
+    }
+#endif
+#ifdef __SSE2__
+    while (end - begin >= 16) {
+        unsigned mask = _mm_movemask_epi8(Class::vec(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin))));
+        if (!Member) {
+            mask = ~mask & 0xFFFF;
+        }
+        if (mask) {
+            return begin + __builtin_ctz(mask);
+        }
+        begin += 16;
+    }
+#endif
+    while (begin != end && Class::scalar(*begin) != Member) {
+        ++begin;
+    }
+    return begin;
+}
+}  // namespace scan_detail
+
+// First char that is not ' ' or '\t'.
+inline const char* scan_blanks(const char* begin, const char* end) {
+    return scan_detail::scan<scan_detail::Blank, false>(begin, end);
+}
+
+// First char that is not a decimal digit.
+inline const char* scan_digits(const char* begin, const char* end) {
+    return scan_detail::scan<scan_detail::Digit, false>(begin, end);
+}
+
+// First occurrence of C.
+template <char C>
+const char* scan_char(const char* begin, const char* end) {
+    return scan_detail::scan<scan_detail::Is<C>, true>(begin, end);
+}
+
+// First whitespace or paren.
+inline const char* scan_atom(const char* begin, const char* end) {
+    return scan_detail::scan<scan_detail::AtomEnd, true>(begin, end);
+}
+
+// Accumulates a run of digits as found by scan_digits().
+inline unsigned digits_value(const char* begin, const char* end) {
+    unsigned acc = 0;
+    for (; begin != end; ++begin) {
+        acc = acc * 10 + (*begin - '0');
+    }
+    return acc;
+}
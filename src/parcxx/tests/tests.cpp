@@ -46,7 +46,136 @@ auto parse_csv() {
            append_last;
 }
 
+// Checks the vectorized scanners against the obvious loops, at every offset
+// of every length up to a few vectors, on random bytes.
+void test_scan() {
+    std::cout << "scanners\n";
+    const char alphabet[] = " \t\n\r\v\f()\"09az\x80\xff";
+    std::string buf;
+    unsigned seed = 42;
+    for (int i = 0; i < 200; ++i) {
+        seed = seed * 1103515245 + 12345;
+        // Long runs of a single char, so that whole vectors match.
+        char c = alphabet[(seed >> 16) % (sizeof(alphabet) - 1)];
+        buf.append((seed >> 8) % 70, c);
+    }
+
+    auto naive = [](const char* b, const char* e, auto pred) {
+        while (b != e && !pred(static_cast<unsigned char>(*b))) {
+            ++b;
+        }
+        return b;
+    };
+    for (size_t i = 0; i < buf.size(); i += 7) {
+        const char* b = buf.data() + i;
+        const char* e = buf.data() + std::min(buf.size(), i + 100);
+        assert(scan_blanks(b, e) ==
+               naive(b, e, [](int c) { return !isblank(c); }));
+        assert(scan_digits(b, e) ==
+               naive(b, e, [](int c) { return !isdigit(c); }));
+        assert(scan_char<'"'>(b, e) ==
+               naive(b, e, [](int c) { return c == '"'; }));
+        assert(scan_atom(b, e) == naive(b, e, [](int c) {
+                   return isspace(c) || c == '(' || c == ')';
+               }));
+    }
+}
+
+// sum := term '+' sum | term '-' sum | term
+// term := '(' sum ')' | digit
+// Every alternative of sum parses the same term again, which takes
+// exponential time on nested parens unless it's memoized.
+struct SumGrammar {
+    template <class P>
+    static Parser<int> maybe_memo(bool memoize, P p) {
+        if (memoize) {
+            return memo(p);
+        }
+        return p;
+    }
+
+    explicit SumGrammar(bool memoize)
+        : term(maybe_memo(
+              memoize,
+              (parse_char('(') >> recursion(sum) << parse_char(')')) |
+                  parse_digit())),
+          sum(maybe_memo(memoize,
+                         (((recursion(term) << parse_char('+')) &
+                           recursion(sum)) %
+                          [](auto x) { return x.first + x.second; }) |
+                             (((recursion(term) << parse_char('-')) &
+                               recursion(sum)) %
+                              [](auto x) { return x.first - x.second; }) |
+                             recursion(term))) {}
+
+    Parser<int> term;
+    Parser<int> sum;
+};
+
+void test_packrat() {
+    SumGrammar plain(false);
+    SumGrammar memoized(true);
+    // Right associative: 1 + ((2 - 3) - 4).
+    expect_true(plain.sum, "1+(2-3)-4", -4);
+    expect_true(packrat(recursion(memoized.sum)), "1+(2-3)-4", -4);
+    // memo() outside of packrat() simply parses.
+    expect_true(memoized.sum, "1+(2-3)-4", -4);
+
+    std::string deep = "1";
+    for (int i = 0; i < 200; ++i) {
+        deep = "(1+" + deep + ")";
+    }
+    expect_true(packrat(recursion(memoized.sum)), deep, 201);
+    expect_false(packrat(recursion(memoized.sum)), ")" + deep);
+}
+
+// The same grammar as statically typed rules.
+struct TermRule;
+
+struct SumRule {
+    template <class Self>
+    static auto build(Self self) {
+        auto term = rule<int, TermRule>();
+        return (((term << parse_char('+')) & self) %
+                [](auto x) { return x.first + x.second; }) |
+               (((term << parse_char('-')) & self) %
+                [](auto x) { return x.first - x.second; }) |
+               term;
+    }
+};
+
+struct TermRule {
+    template <class Self>
+    static auto build(Self) {
+        return (parse_char('(') >> rule<int, SumRule>() << parse_char(')')) |
+               parse_digit();
+    }
+};
+
+void test_rules() {
+    auto sum = rule<int, SumRule>();
+    expect_true(sum, "1+(2-3)-4", -4);
+    expect_false(sum, "(1+2");
+
+    std::string deep = "1";
+    for (int i = 0; i < 8; ++i) {
+        deep = "(1+" + deep + ")";
+    }
+    expect_true(sum, deep, 9);
+    expect_true(packrat(sum), deep, 9);
+
+    auto ref = parser_ref(sum);
+    static_assert(std::is_same<decltype(ref), ParserRef<int>>::value,
+                  "parser_ref deduces the result type");
+    expect_true(ref, "1+(2-3)-4", -4);
+    auto two = parse_digit() & parse_digit();
+    expect_true(parser_ref(two), "12", std::make_pair(1, 2));
+}
+
 int main(int argc, char** argv) {
+    test_scan();
+    test_packrat();
+    test_rules();
     expect_true(skipL(ignore_whitespaces(), parse_uint()), "666a", 666);
     expect_true(parse_digit(), "1aa", 1);
     expect_true(parse_digit(), "12", 1);
@@ -60,6 +189,9 @@ int main(int argc, char** argv) {
     expect_false(parse_uint(), "a666a");
     expect_true(parse_int(), "666a", 666);
     expect_true(ignore_whitespaces() >> parse_uint(), "   666a", 666);
+    expect_true(ignore_blank() >> parse_uint(),
+                "    \t                                  123456789a",
+                123456789);
     expect_true(ignore_whitespaces() >> parse_int(), "-666a", -666);
     expect_true(ignore_whitespaces() >> parse_int(), "-666a", -666);
     expect_true(parse_word("yes", 42), "yes", 42);
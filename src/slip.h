@@ -1,9 +1,19 @@
 #pragma once
 
 #include "impl/ast.h"
+#include "impl/bytecode.h"
+#include "impl/const-eval.h"
 #include "impl/context-impl.h"
 #include "impl/eval.h"
+#include "impl/flat-ast.h"
 #include "impl/function-impl.h"
+#include "impl/loader.h"
+#include "impl/mapped-file.h"
 #include "impl/parser.h"
+#include "impl/prepared.h"
 #include "impl/print.h"
+#include "impl/rd-parser.h"
+#include "impl/script.h"
 #include "impl/typecheck.h"
+#include "impl/typed-ast.h"
+#include "impl/wire.h"
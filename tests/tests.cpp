@@ -1,6 +1,34 @@
 #include "slip.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+// Allocations are counted, for tests of what mustn't allocate.
+std::atomic<size_t> g_allocs(0);
+
+void* operator new(size_t size) {
+    ++g_allocs;
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+// GCC can't tell that the pointer comes from the malloc above.
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
 
 template <class T>
 void expect_eq(std::string in, std::string parse, T x, slip::Context& ctx) {
@@ -14,6 +42,16 @@ void expect_eq(std::string in, std::string parse, T x, slip::Context& ctx) {
     auto eval = Eval<std::decay_t<T>>(res->first, ctx);
     assert(eval == x);
     std::cout << "=> " << eval << "\n";
+    auto typed = Annotate(res->first, ctx);
+    assert(Eval<std::decay_t<T>>(typed, ctx) == x);
+    assert(Eval<std::decay_t<T>>(Compile(res->first, ctx), ctx) == x);
+    Link(res->first, ctx);
+    assert(Eval<std::decay_t<T>>(res->first, ctx) == x);
+
+    auto flat = ParseFlat(in);
+    TypeCheck(flat->first.root(), ctx);
+    assert(Print(flat->first.root()) == parse);
+    assert(Eval<std::decay_t<T>>(flat->first.root(), ctx) == x);
 }
 
 void CheckType(std::string in, std::string type, slip::Context& ctx) {
@@ -22,6 +60,8 @@ void CheckType(std::string in, std::string type, slip::Context& ctx) {
     auto res = Parse(in);
     TypeCheck(res->first, ctx);
     assert(TypeExpression(res->first, ctx).Show() == type);
+    auto flat = ParseFlat(in);
+    assert(TypeExpression(flat->first.root(), ctx).Show() == type);
 }
 
 void test_concrete_functions() {
@@ -76,6 +116,65 @@ void test_prototype() {
     Namer namer;
     b_fun.Instantiate(namer);
     assert(b_fun.Show() == "forall a b. a -> b");
+
+    // More variables than are kept inline, met out of order.
+    Type wide = TypeVar(0);
+    for (int i = 12; i > 0; --i) {
+        wide = Arrow(TypeVar(i * 7 % 13), wide);
+    }
+    TypeVars vars;
+    FindVars(wide, vars);
+    assert(vars.size() == 13 && std::is_sorted(vars.begin(), vars.end()));
+    assert(vars.IndexOf(12) == 12 && vars.IndexOf(13) == -1);
+    Prototype wide_fun(wide);
+    Namer wide_namer;
+    wide_namer.NewName();
+    wide_fun.Instantiate(wide_namer);
+    assert(wide_fun.Show() ==
+           "forall b c d e f g h i j k l m n. i -> c -> j -> d -> k -> e -> "
+           "l -> f -> m -> g -> n -> h -> b");
+
+    // A call site is checked at once. A variable met twice is unified with
+    // what it's already bound to, rather than rejected.
+    assert(fif.Apply({Prototype(ConstType("Bool")),
+                      Prototype(ConstType("Int")),
+                      Prototype(ConstType("Int"))})
+               .Show() == "Int");
+    try {
+        fif.Apply({Prototype(ConstType("Bool")),
+                   Prototype(ConstType("Int")),
+                   Prototype(ConstType("Bool"))});
+        assert(false);
+    } catch (const std::runtime_error& e) {
+        assert(std::string(e.what()) == "Can't unify Int and Bool");
+    }
+    Prototype twice(Arrow(Arrow(TypeVar(0), TypeVar(0)), TypeVar(0)));
+    assert(twice.Apply(Prototype(Arrow(ConstType("Int"), ConstType("Int"))))
+               .Show() == "Int");
+    try {
+        twice.Apply(
+            Prototype(Arrow(TypeVar(0), Arrow(TypeVar(0), TypeVar(0)))));
+        assert(false);
+    } catch (const std::runtime_error& e) {
+        assert(std::string(e.what()) ==
+               "Can't unify b and b -> b: infinite type");
+    }
+
+    // Types are hash-consed: equal types are the same node.
+    Type int_int = Arrow(ConstType("Int"), ConstType("Int"));
+    assert(int_int == f1.type());
+    assert(int_int.lhs() == int_int.rhs());
+    assert(int_int != Type(Arrow(ConstType("Int"), TypeVar(0))));
+    assert(fif.Apply(Prototype(ConstType("Bool"))).type() ==
+           Type(Arrow(TypeVar(0), Arrow(TypeVar(0), TypeVar(0)))));
+    // Substitution shares what it doesn't change.
+    Type sub = Arrow(ConstType("Bool"), int_int);
+    Substitutions subs;
+    subs.emplace(0, ConstType("Int"));
+    assert(Substitute(subs, sub) == sub);
+    Type poly = Arrow(TypeVar(0), int_int);
+    assert(Substitute(subs, poly).rhs() == poly.rhs());
+    assert(Substitute(subs, poly) == Type(Arrow(ConstType("Int"), int_int)));
 }
 
 void test_polymorphic_functions() {
@@ -109,9 +208,974 @@ void test_types() {
     ctx.ImportBase();
     CheckType("((+ 1) 2)", "Int", ctx);
     CheckType("((if true) 42)", "Int -> Int", ctx);
+
+    // Signatures built from C++ types are the ones their names parse to.
+    using F = int (*)(const std::string&, bool);
+    using Sig = ManglerCaller<F>;
+    assert(Sig::Signature() == ParseType(Sig::Mangle()).type());
+    assert(Prototype(Sig::Signature()).Show() == "String -> Bool -> Int");
+    using Thunk = ManglerCaller<bool (*)()>;
+    assert(Thunk::Signature() == ParseType(Thunk::Mangle()).type());
+    assert(ctx.Find("+")->type().Show() == "Int -> Int -> Int");
+
+    for (const char* bad : {"", "-> Int", "(Int"}) {
+        try {
+            ctx.DeclareFun("bad", bad, [](int x) { return x; });
+            assert(false);
+        } catch (const std::runtime_error& e) {
+            assert(e.what() == std::string("bad type: ") + bad);
+        }
+    }
+}
+
+void test_typed_ast() {
+    using namespace slip;
+    Context ctx;
+    ctx.ImportBase();
+    auto res = Parse("(+ (if true 1 2) ((+ 3) 4))");
+    auto typed = Annotate(res->first, ctx);
+    assert(typed.node_count() == 12);
+    TypedVal root = typed.root();
+    assert(Prototype(root.type()).Show() == "Int");
+    assert(root.arity() == 2 && root.size() == 3);
+    assert(root.head().function() == ctx.Find("+"));
+    assert(Prototype(root.head().type()).Show() == "Int -> Int -> Int");
+    auto it = ++root.begin();
+    TypedVal if_call = *it;
+    assert(if_call.arity() == 3 && if_call.head().function() == ctx.Find("if"));
+    TypedVal partial = *++it;
+    assert(partial.arity() == -1);
+    assert(Prototype(partial.head().type()).Show() == "Int -> Int");
+    assert(Eval<int>(typed, ctx) == 8);
+
+    // Only the type of the root is checked.
+    bool thrown = false;
+    try {
+        Eval<std::string>(typed, ctx);
+    } catch (std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(Eval<Polymorphic>(typed, ctx).as<int>() == 8);
+
+    auto plus = Parse("(+ 1)");
+    auto typed_plus = Annotate(plus->first, ctx);
+    Closure add1 = Eval<Closure>(typed_plus, ctx);
+    assert(add1.Show() == "+ (1) _");
+}
+
+void test_type_cache() {
+    using namespace slip;
+    Context ctx;
+    ctx.ImportBase();
+    TypeCache& cache = ctx.type_cache();
+    cache.Clear();
+
+    // Scripts are told apart by their shape, not by the values of their
+    // literals.
+    auto a = Parse("(if (< 1 2) \"a\" \"b\")");
+    auto b = Parse("(if (< 3 4) \"a\" \"c\")");
+    auto c = Parse("(if (< 1 2) 1 2)");
+    assert(StructuralHash(a->first) == StructuralHash(b->first));
+    assert(StructurallyEqual(a->first, b->first));
+    assert(StructuralHash(a->first) != StructuralHash(c->first));
+    assert(!StructurallyEqual(a->first, c->first));
+    assert(TypeExpression(a->first, ctx).Show() == "String");
+    assert(cache.hits() == 0 && cache.misses() == 1);
+    TypeCheck(a->first, ctx);
+    TypeCheck(b->first, ctx);
+    assert(cache.hits() == 2 && cache.size() == 1);
+    assert(TypeExpression(c->first, ctx).Show() == "Int");
+    assert(cache.misses() == 2 && cache.size() == 2);
+    for (int i = 0; i < 20; ++i) {
+        std::string n = std::to_string(i);
+        TypeCheck(Parse("(+ (* " + n + " 2) " + n + ")")->first, ctx);
+    }
+    assert(cache.misses() == 3 && cache.size() == 3);
+
+    // Entries don't keep strings: a borrowing script doesn't leave them
+    // dangling.
+    size_t borrowed_hash;
+    {
+        auto buffer =
+            std::make_shared<const std::string>("(+s \"borrowed\" \"x\")");
+        auto script = ParseScript(buffer);
+        borrowed_hash = StructuralHash(script->root());
+        assert(TypeExpression(script->root(), ctx).Show() == "String");
+    }
+    auto owned = Parse("(+s \"borrowed\" \"x\")");
+    assert(StructuralHash(owned->first) == borrowed_hash);
+    size_t hits = cache.hits();
+    assert(TypeExpression(owned->first, ctx).Show() == "String");
+    assert(cache.hits() == hits + 1);
+
+    // Errors aren't cached.
+    auto bad = Parse("(+ 1 \"a\")");
+    for (int i = 0; i < 2; ++i) {
+        try {
+            TypeCheck(bad->first, ctx);
+            assert(false);
+        } catch (std::runtime_error&) {
+        }
+    }
+
+    // Declaring a function may change the type of any script.
+    ctx.DeclareFun("+s", [](int x, int y) -> int { return x + y; });
+    assert(cache.size() == 0);
+    assert(TypeExpression(owned->first, ctx).Show() == "String");
+    // A hit binds the calls of the script like type checking it would.
+    TypeCheck(Parse("(+s 1 2)")->first, ctx);
+    auto ints = Parse("(+s 1 2)");
+    hits = cache.hits();
+    assert(TypeExpression(ints->first, ctx).Show() == "Int");
+    assert(cache.hits() == hits + 1);
+    assert(Eval<int>(ints->first, ctx) == 3);
+
+    cache.set_capacity(2);
+    for (std::string op : {"+", "-", "*", "/", "%"}) {
+        TypeCheck(Parse("(" + op + " 1 2)")->first, ctx);
+    }
+    assert(cache.size() == 2);
+    hits = cache.hits();
+    TypeCheck(Parse("(% 3 4)")->first, ctx);
+    TypeCheck(Parse("(+ 3 4)")->first, ctx);
+    assert(cache.hits() == hits + 1);
+    cache.set_capacity(0);
+    TypeCheck(a->first, ctx);
+    assert(cache.size() == 0 && cache.hits() == 0);
+}
+
+void test_polymorphic_values() {
+    using namespace slip;
+    // Or vectors of them would copy their values to grow.
+    static_assert(std::is_nothrow_move_constructible<Polymorphic>::value, "");
+    static_assert(std::is_nothrow_move_assignable<Polymorphic>::value, "");
+    std::array<int, 32> big{};
+    big[31] = 7;
+    std::vector<Polymorphic> values;
+    values.emplace_back(42);
+    values.emplace_back(true);
+    values.emplace_back(std::string("a string too long for SSO buffers"));
+    values.emplace_back(big);
+    // Growing moves every value.
+    for (int i = 0; i < 100; ++i) {
+        values.push_back(values[i % 4]);
+    }
+    for (size_t i = 0; i < values.size(); i += 4) {
+        assert(values[i].as<int>() == 42 && !values[i].as<bool*>());
+        assert(values[i + 1].as<bool>());
+        assert(values[i + 2].as<std::string>().size() == 33);
+        assert((values[i + 3].as<std::array<int, 32>>()[31] == 7));
+    }
+    Polymorphic x = values[2];
+    x = values[0];
+    assert(x.as<int>() == 42);
+    x = std::move(values[3]);
+    x = x;
+    assert((x.as<std::array<int, 32>>()[31] == 7));
+    x = Polymorphic();
+    assert(!x.as<int*>());
+    // Ints, bools and strings are stored inline.
+    std::string str = "short";
+    size_t allocs = g_allocs;
+    {
+        Polymorphic s = str;
+        Polymorphic b = false;
+        Polymorphic moved = std::move(s);
+        b = std::move(moved);
+        Polymorphic n = 1;
+        n = b;
+        assert(n.as<std::string>() == "short");
+    }
+    assert(g_allocs == allocs);
+    // Tags tell apart even types that convert to each other.
+    Polymorphic u = 42u;
+    assert(!u.as<int*>() && *u.as<unsigned*>() == 42);
+    bool thrown = false;
+    try {
+        u.as<int>();
+    } catch (std::bad_cast&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+void test_closures() {
+    using namespace slip;
+    static_assert(std::is_nothrow_move_constructible<Closure>::value, "");
+    static_assert(std::is_nothrow_move_assignable<Closure>::value, "");
+    Context ctx;
+    ctx.ImportBase();
+    // Too big to be stored inline.
+    std::array<int, 64> big{};
+    big[63] = 2;
+    ctx.DeclareFun("big", [big](int x) -> int { return big[63] * x; });
+    for (std::string in : {"(big 21)", "(+s \"a\" \"b\")", "((+ 1) 41)"}) {
+        auto res = Parse(in);
+        TypeCheck(res->first, ctx);
+        Closure fun = Eval<Closure>(boost::get<List>(res->first)[0], ctx);
+        Closure copy = fun;
+        Closure moved = std::move(fun);
+        fun = std::move(copy);
+        moved = std::move(moved);
+        assert(fun.Show() == moved.Show());
+        Polymorphic boxed = Eval<Polymorphic>(res->first, ctx);
+        Polymorphic copied = boxed;
+        assert(copied.Show() == boxed.Show());
+    }
+    // Closures that leave the evaluation own their string arguments.
+    ctx.DeclareFun("vcat", [](boost::string_view a, boost::string_view b) {
+        return a.to_string() + b.to_string();
+    });
+    const std::string text = "a string too long to be stored inline";
+    for (std::string in : {"(+s \"" + text + "\")",
+                           "(vcat \"" + text + "\")"}) {
+        auto tree = std::make_unique<Val>(Parse(in)->first);
+        TypeCheck(*tree, ctx);
+        auto typed = std::make_unique<TypedAst>(Annotate(*tree, ctx));
+        Closure escaped = Eval<Closure>(*tree, ctx);
+        Closure typed_escaped = Eval<Closure>(*typed, ctx);
+        Polymorphic boxed = Eval<Polymorphic>(*tree, ctx);
+        typed.reset();
+        tree.reset();
+        Val b = Str(std::string("b"));
+        for (Closure c : {escaped, typed_escaped, boxed.as<Closure>()}) {
+            c.Apply(b, ctx);
+            assert(c.GetResult<std::string>() == text + "b");
+        }
+    }
+    auto big_call = Parse("(big 21)");
+    TypeCheck(big_call->first, ctx);
+    assert(Eval<int>(big_call->first, ctx) == 42);
+    // Neither closures nor their results allocate.
+    ctx.DeclareFun("len", [](const std::string& s) -> int { return s.size(); });
+    auto calls = Parse("(+ (len (+s \"ab\" \"cd\")) ((+ 1) 2))");
+    TypeCheck(calls->first, ctx);
+    Link(calls->first, ctx);
+    size_t allocs = g_allocs;
+    assert(Eval<int>(calls->first, ctx) == 7);
+    assert(g_allocs == allocs);
+}
+
+void test_link() {
+    using namespace slip;
+    Context ctx;
+    ctx.ImportBase();
+    auto res = Parse("(+ (+ 1 2) 3)");
+    auto head = [&] {
+        const Atom& atom = boost::get<Atom>(boost::get<List>(res->first)[0]);
+        return atom.function(ctx.stamp());
+    };
+    TypeCheck(res->first, ctx);
+    assert(!head());
+    Link(res->first, ctx);
+    assert(head() == ctx.Find("+"));
+    assert(Eval<int>(res->first, ctx) == 6);
+    // Checking again unlinks, cached or not.
+    TypeCheck(res->first, ctx);
+    assert(ctx.type_cache().hits() > 0 && !head());
+
+    // Links hold only in the context and declarations they were made with.
+    auto sum = Parse("(+ 2 3)");
+    TypeCheck(sum->first, ctx);
+    Link(sum->first, ctx);
+    Context other;
+    other.DeclareFun("+", [](int a, int b) -> int { return a * b; });
+    assert(Eval<int>(sum->first, other) == 6);
+    ctx.DeclareFun("+", [](int a, int b) -> int { return a - b; });
+    assert(Eval<int>(sum->first, ctx) == -1);
+
+    // Closures share the name of their function.
+    auto partial = Parse("(+s \"a\")");
+    TypeCheck(partial->first, ctx);
+    Link(partial->first, ctx);
+    assert(Eval<Closure>(partial->first, ctx).Show() == "+s (a) _");
+}
+
+void test_bytecode() {
+    using namespace slip;
+    Context ctx;
+    ctx.ImportBase();
+    ctx.DeclareFun("len", [](const std::string& s) -> int { return s.size(); });
+    ctx.DeclareFun("id", "a -> a", [](const Polymorphic& x) { return x; });
+    auto ops = [&](const std::string& in) {
+        auto res = Parse(in);
+        Bytecode code = Compile(res->first, ctx);
+        std::string ops;
+        for (size_t i = 0; i < code.size(); ++i) {
+            ops += std::to_string(static_cast<int>(code.instr(i).op)) + " ";
+        }
+        return ops;
+    };
+    using Op = Bytecode::Op;
+    auto op = [](Op op) { return std::to_string(static_cast<int>(op)) + " "; };
+
+    // Builtins are instructions, other functions calls.
+    assert(ops("(+ 1 (* 2 3))") ==
+           op(Op::LoadInt) + op(Op::LoadInt) + op(Op::LoadInt) + op(Op::Mul) +
+               op(Op::Add) + op(Op::Return));
+    assert(ops("(len \"abc\")") ==
+           op(Op::LoadConst) + op(Op::Call) + op(Op::Return));
+    // Ints are boxed for a Polymorphic parameter, and unboxed from its
+    // result.
+    assert(ops("(id 1)") == op(Op::LoadInt) + op(Op::BoxInt) + op(Op::Call) +
+                                op(Op::UnboxInt) + op(Op::Return));
+    // Partial applications are evaluated from the tree.
+    assert(ops("((+ 1) 2)") == op(Op::Tree) + op(Op::Return));
+
+    auto eval = [&](const std::string& in) {
+        auto res = Parse(in);
+        return Eval<Polymorphic>(Compile(res->first, ctx), ctx);
+    };
+    assert(eval("(if (< (len \"ab\") 3) (id \"x\") \"y\")")
+               .as<std::string>() == "x");
+    assert(eval("(and (id true) (not (== (% 7 4) 3)))").as<bool>() == false);
+    assert(eval("(const (+ (id 1) 2) (+s \"a\" \"b\"))").as<int>() == 3);
+    assert(eval("(+ 1)").as<Closure>().Show() == "+ (1) _");
+
+    auto res = Parse("(< 1 2)");
+    Bytecode code = Compile(res->first, ctx);
+    try {
+        Eval<int>(code, ctx);
+        assert(false);
+    } catch (std::runtime_error&) {
+    }
+    // Many temporaries don't fit in the registers on the stack.
+    std::string wide = "1";
+    for (int i = 0; i < 20; ++i) {
+        wide = "(+ 1 " + wide + ")";
+    }
+    auto wide_res = Parse(wide);
+    assert(Eval<int>(Compile(wide_res->first, ctx), ctx) == 21);
+}
+
+void test_const_eval() {
+    using namespace slip;
+    static_assert(ConstEval<int>("(+ 1 (* 2 3))") == 7, "");
+    static_assert(ConstEval<bool>("(and (< 1 2) (not (== 3 4)))"), "");
+    // The branch not taken isn't evaluated.
+    static_assert(ConstEval<int>("(if (>= 2 3) (/ 1 0) (% 17 5))") == 2, "");
+    constexpr ConstScript<32> script("(const (- 1 10) true)", 21);
+    static_assert(script.type() == ConstScript<32>::Kind::Int, "");
+    static_assert(script.Eval<int>() == -9, "");
+
+    Context ctx;
+    ctx.ImportBase();
+    assert(ConstEval<int>("(- (* 3 (return 5)) (/ 7 2))") ==
+           Eval<int>(Parse("(- (* 3 (return 5)) (/ 7 2))")->first, ctx));
+    assert(ConstEval<bool>("(or\tfalse (> 1 0))   trailing") ==
+           Eval<bool>(Parse("(or\tfalse (> 1 0))   trailing")->first, ctx));
+
+    auto throws = [](auto f) {
+        try {
+            f();
+        } catch (std::runtime_error&) {
+            return true;
+        }
+        return false;
+    };
+    assert(throws([] { ConstEval<int>("(< 1 2)"); }));
+    assert(throws([] { ConstEval<int>("(+ 1 true)"); }));
+    assert(throws([] { ConstEval<int>("(if true 1 false)"); }));
+    assert(throws([] { ConstEval<int>("(+ 1)"); }));
+    assert(throws([] { ConstEval<int>("(+s \"a\" \"b\")"); }));
+    assert(throws([] { ConstEval<int>("(+ \"a\" \"b\")"); }));
+    assert(throws([] { ConstEval<int>("(% 1 0)"); }));
+    assert(throws([] { ConstEval<int>("(+ 1 2"); }));
+}
+
+void test_overloads() {
+    using namespace slip;
+    Context ctx;
+    ctx.ImportBase();
+    expect_eq("(+ \"a\" \"b\")",
+              "[+:atom \"a\":str \"b\":str]",
+              std::string("ab"),
+              ctx);
+    expect_eq("(+ (+ 1 2) 3)", "[+:atom [+:atom 1:int 2:int] 3:int]", 6, ctx);
+    expect_eq("((+ \"a\") \"b\")",
+              "[[+:atom \"a\":str] \"b\":str]",
+              std::string("ab"),
+              ctx);
+    // Special forms get the overload of the calls under them, from either
+    // kind of tree.
+    expect_eq("(if true (+ \"a\" \"b\") \"c\")",
+              "[if:atom 1:bool [+:atom \"a\":str \"b\":str] \"c\":str]",
+              std::string("ab"),
+              ctx);
+    // Threads may evaluate the same flat tree, special forms included.
+    auto flat = ParseFlat("(if (< 1 2) (+ \"a\" \"b\") (if true \"c\" \"\"))");
+    TypeCheck(flat->first.root(), ctx);
+    std::atomic<int> right{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&] {
+            for (int j = 0; j < 100; ++j) {
+                right += Eval<std::string>(flat->first.root(), ctx) == "ab";
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    assert(right == 400);
+    CheckType("(+ 1)", "Int -> Int", ctx);
+    // Without arguments, the first one declared.
+    CheckType("(+)", "Int -> Int -> Int", ctx);
+
+    PreparedScript concat(ctx, "(+ ?0 \"!\")");
+    assert(Show(concat.param_type(0)) == "String");
+    assert(concat.Run<std::string>("hi") == "hi!");
+
+    auto throws = [&](const std::string& in) {
+        try {
+            TypeCheck(Parse(in)->first, ctx);
+        } catch (std::runtime_error&) {
+            return true;
+        }
+        return false;
+    };
+    assert(throws("(+ 1 \"a\")"));
+    assert(throws("(+ true)"));
+    // Placeholders that could be of either type get the first overload.
+    PreparedScript add(ctx, "(+ ?0 ?1)");
+    assert(Show(add.param_type(0)) == "Int");
+    assert(Show(add.param_type(1)) == "Int");
+    assert(add.Run<int>(2, 3) == 5);
+    PreparedScript greet(ctx, "(+ \"hi \" ?0)");
+    assert(greet.Run<std::string>("you") == "hi you");
+    // When the first overload that fits a call doesn't fit where its result
+    // goes, the next ones are tried.
+    PreparedScript nested(ctx, "(+s (+ ?0 ?1) \"x\")");
+    assert(Show(nested.param_type(0)) == "String");
+    assert(nested.Run<std::string>("a", "b") == "abx");
+    PreparedScript deep(ctx, "(+s (+ ?0 ?1) (+ ?1 ?2))");
+    assert(deep.Run<std::string>("a", "b", "c") == "abbc");
+    try {
+        PreparedScript(ctx, "(+s (+ ?0 1) \"x\")");
+        assert(false);
+    } catch (const std::runtime_error&) {
+    }
+
+    ctx.DeclareFun("show", [](int) -> std::string { return "int"; });
+    ctx.DeclareFun("show", [](bool) -> std::string { return "bool"; });
+    expect_eq(
+        "(show true)", "[show:atom 1:bool]", std::string("bool"), ctx);
+    expect_eq("(show 1)", "[show:atom 1:int]", std::string("int"), ctx);
+    // The same signature replaces the function.
+    ctx.DeclareFun("show", [](int) -> std::string { return "an int"; });
+    assert(ctx.Overloads(Atom("show").symbol()).size() == 2);
+    expect_eq("(show 1)", "[show:atom 1:int]", std::string("an int"), ctx);
+    // What was built against the replaced function can still run.
+    auto linked = Parse("(show 2)");
+    TypeCheck(linked->first, ctx);
+    Link(linked->first, ctx);
+    TypedAst typed = Annotate(linked->first, ctx);
+    Bytecode code = Compile(linked->first, ctx);
+    Closure partial = Eval<Closure>(Parse("(show)")->first, ctx);
+    ctx.DeclareFun("show", [](int) -> std::string { return "a number"; });
+    assert(Eval<std::string>(linked->first, ctx) == "a number");
+    assert(Eval<std::string>(typed, ctx) == "an int");
+    assert(Eval<std::string>(code, ctx) == "an int");
+    partial.Apply(Int(3), ctx);
+    assert(partial.GetResult<std::string>() == "an int");
+    TypeCheck(linked->first, ctx);
+    assert(Eval<std::string>(linked->first, ctx) == "a number");
+}
+
+void test_prepared() {
+    using namespace slip;
+    Context ctx;
+    ctx.ImportBase();
+
+    PreparedScript arith(ctx, "(+ ?0 (* ?1 2))");
+    assert(arith.param_count() == 2);
+    assert(Show(arith.param_type(0)) == "Int");
+    assert(arith.Run<int>(1, 3) == 7);
+    assert(arith.Run<int>(-4, 2) == 0);
+
+    // Placeholders in arguments of special functions, and used twice.
+    PreparedScript size(ctx, "(if (< ?0 10) (+s ?1 ?1) \"big\")");
+    assert(Show(size.param_type(1)) == "String");
+    assert(Show(size.type()) == "String");
+    assert(size.Run<std::string>(3, "ab") == "abab");
+    assert(size.Run<std::string>(30, std::string("ab")) == "big");
+    assert(size.Run<Polymorphic>(3, "a").as<std::string>() == "aa");
+
+    PreparedScript partial(ctx, "((if ?0 (+) (*)) 2 3)");
+    assert(partial.Run<int>(true) == 5 && partial.Run<int>(false) == 6);
+
+    auto throws = [](auto f) {
+        try {
+            f();
+        } catch (std::runtime_error&) {
+            return true;
+        }
+        return false;
+    };
+    assert(throws([&] { arith.Run<int>(1); }));
+    assert(throws([&] { arith.Run<int>(1, "2"); }));
+    assert(throws([&] { arith.Run<std::string>(1, 2); }));
+    assert(throws([&] { PreparedScript(ctx, "(* ?0 \"a\")"); }));
+    assert(throws([&] { PreparedScript(ctx, "(+ ?0 ?2)"); }));
+    // Nothing tells what ?0 is.
+    assert(throws([&] { PreparedScript(ctx, "(return ?0)"); }));
+}
+
+void test_parsers() {
+    using namespace slip;
+    const std::vector<std::string> inputs = {
+        "(+ 1 2)",
+        "(+s \"Werez my \" \"SLIP?\")",
+        "((if (< 1 2) (+) (*)) 2 3)",
+        "(\t f  12abc  \"x\"y  truex false ) trailing",
+        "(f \"unterminated)",
+        "(f \"\")",
+        "()",
+        "(f (g) ((h 1)))",
+        "(f\n1)",
+        "(f (g)",
+        " (f)",
+        "(a_rather_long_atom_that_spans_more_than_one_vector      \t    "
+        "\"and a string literal that is also longer than thirty two\" "
+        "123456789012345678901234567890123 12345678)",
+        "",
+    };
+    for (auto& in : inputs) {
+        std::cout << in << "\n";
+        auto comb = Parse(in, ParserKind::Combinator);
+        auto rd = Parse(in, ParserKind::RecursiveDescent);
+        auto flat = ParseFlat(in);
+        assert(!comb == !rd);
+        assert(!comb == !flat);
+        if (comb) {
+            assert(Print(comb->first) == Print(rd->first));
+            assert(comb->second == rd->second);
+            assert(Print(comb->first) == Print(flat->first.root()));
+        }
+    }
+}
+
+void test_symbols() {
+    using namespace slip;
+    Context ctx;
+    ctx.ImportBase();
+    auto a = ParseRD("(+ 1 2)");
+    auto b = Parse("(+ 3 4)");
+    const Atom* plus_a = boost::get<List>(a->first).GetFunAtom();
+    const Atom* plus_b = boost::get<List>(b->first).GetFunAtom();
+    assert(*plus_a == *plus_b);
+    assert(plus_a->val() == "+");
+    assert(ctx.Find(plus_a->symbol()) == ctx.Find("+"));
+    assert(ctx.Find("no such function") == nullptr);
+    assert(Atom("-") != *plus_a);
+
+    // Threads intern the same names at once, and agree on their ids.
+    std::vector<std::thread> threads;
+    std::vector<std::vector<int>> ids(4);
+    for (auto& thread_ids : ids) {
+        threads.emplace_back([&thread_ids] {
+            for (int i = 0; i < 2000; ++i) {
+                std::string name = "concurrent" + std::to_string(i % 500);
+                int id = Atom(name).symbol();
+                assert(SymbolTable::Global().Name(id) == name);
+                thread_ids.push_back(id);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (auto& thread_ids : ids) {
+        assert(thread_ids == ids[0]);
+    }
+
+    // The tables are bounded: new names and types fail past their limits,
+    // those already there don't.
+    SymbolTable& symbols = SymbolTable::Global();
+    size_t limit = symbols.limit();
+    symbols.set_limit(symbols.size() + 1);
+    Atom("one_more");
+    auto throws = [](auto f) {
+        try {
+            f();
+        } catch (std::runtime_error&) {
+            return true;
+        }
+        return false;
+    };
+    assert(throws([] { ParseRD("(+ 1 two_more)"); }));
+    assert(!throws([] { ParseRD("(+ 1 one_more)"); }));
+    symbols.set_limit(limit);
+    size_t byte_limit = symbols.byte_limit();
+    symbols.set_byte_limit(symbols.bytes() + 4);
+    assert(throws([] { Atom("short"); }));
+    assert(!throws([] { Atom("tiny"); }));
+    symbols.set_byte_limit(byte_limit);
+
+    TypeTable& types = TypeTable::Global();
+    limit = types.limit();
+    types.set_limit(types.size());
+    assert(throws([] { Type(ConstType("NewType")); }));
+    assert(!throws([] { Type(ConstType("Int")); }));
+    types.set_limit(limit);
+    assert(Prototype(ConstType("NewType")).Show() == "NewType");
+}
+
+void test_borrowed_strings() {
+    using namespace slip;
+    // Or lists of them would copy their strings to grow.
+    static_assert(std::is_nothrow_move_constructible<Str>::value, "");
+    Context ctx;
+    const char* seen_data = nullptr;
+    const std::string* seen_str = nullptr;
+    ctx.DeclareFun("vlen", [&](boost::string_view s) -> int {
+        seen_data = s.data();
+        return s.size();
+    });
+    ctx.DeclareFun("slen", [&](const std::string& s) -> int {
+        seen_str = &s;
+        return s.size();
+    });
+
+    auto buffer = std::make_shared<const std::string>("(vlen \"hello\")");
+    auto script = ParseScript(buffer);
+    const char* literal = buffer->data() + buffer->find('h');
+    buffer.reset();
+    TypeCheck(script->root(), ctx);
+    assert(Print(script->root()) == "[vlen:atom \"hello\":str]");
+    assert(Eval<int>(script->root(), ctx) == 5);
+    assert(seen_data == literal);
+
+    auto owned = ParseRD("(slen \"hello\")");
+    TypeCheck(owned->first, ctx);
+    assert(Eval<int>(owned->first, ctx) == 5);
+    const Val& literal_val = boost::get<List>(owned->first)[1];
+    assert(seen_str == boost::get<Str>(literal_val).owned());
+
+    auto copy = script->root();
+    assert(Eval<int>(copy, ctx) == 5);
+    assert(seen_data == literal);
+    Str moved = std::move(boost::get<Str>(boost::get<List>(copy)[1]));
+    assert(moved.borrowed() && moved.view().data() == literal);
+    Str world = Str("world");
+    Str world_copy = world;
+    assert(world_copy.view() == "world" &&
+           world_copy.view().data() == world_copy.owned()->data());
+}
+
+void test_buffers() {
+    using namespace slip;
+    Context ctx;
+    ctx.ImportBase();
+
+    // Only the middle of the buffer is a script, and nothing terminates it.
+    const char buffer[] = {'x', '(', '+', ' ', '1', ' ', '2', ')', 'y'};
+    auto res = Parse(buffer + 1, buffer + 8);
+    assert(res && res->second == buffer + 8);
+    assert(Eval<int>(res->first, ctx) == 3);
+    auto view = Parse(boost::string_view(buffer + 1, 6));
+    assert(!view);
+    auto rd = Parse(boost::string_view(buffer + 1, 7),
+                    ParserKind::RecursiveDescent);
+    assert(rd && rd->second == buffer + 8);
+    assert(ParseType(boost::string_view("Int -> Intx", 10)).Show() ==
+           "Int -> Int");
+
+    char path[] = "/tmp/slip-test-XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    std::ofstream(path) << "(+s \"in \" \"place\")";
+    auto script = ParseFile(path);
+    assert(script);
+    TypeCheck(script->root(), ctx);
+    assert(Eval<std::string>(script->root(), ctx) == "in place");
+    std::remove(path);
+
+    try {
+        ParseFile(path);
+        assert(false);
+    } catch (const std::runtime_error&) {
+    }
+}
+
+// A stream written by another thread, like a pipe: reads wait until
+// something is written, and only get what was written so far.
+class PipeBuf : public std::streambuf {
+   public:
+    void Write(const std::string& s) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_ += s;
+        written_.notify_all();
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        written_.notify_all();
+    }
+
+   protected:
+    int_type underflow() override {
+        std::unique_lock<std::mutex> lock(mutex_);
+        written_.wait(lock, [&] { return closed_ || !pending_.empty(); });
+        if (pending_.empty()) {
+            return traits_type::eof();
+        }
+        read_.swap(pending_);
+        pending_.clear();
+        setg(&read_[0], &read_[0], &read_[0] + read_.size());
+        return traits_type::to_int_type(read_[0]);
+    }
+
+   private:
+    std::mutex mutex_;
+    std::condition_variable written_;
+    std::string pending_;
+    std::string read_;
+    bool closed_ = false;
+};
+
+void test_loader() {
+    using namespace slip;
+    Context ctx;
+    ctx.ImportBase();
+    Loader::Options opts;
+    // Tiny chunks and queue: forms span several reads and the reader waits.
+    opts.chunk_size = 3;
+    opts.queue_size = 1;
+    Loader loader(ctx, opts);
+
+    std::istringstream in(
+        "(+ 1 2)\n\n  (+s \"multi\nline\" \"!\")\n(const 1 2)(+ 1 (+ 2 3))\n");
+    std::vector<std::string> results;
+    size_t count = loader.Run(in, [&](const Val& form, Polymorphic& res) {
+        results.push_back(Print(form) + " " + res.Show());
+    });
+    assert(count == 4);
+    assert(results[0] == "[+:atom 1:int 2:int] 3");
+    assert(results[1] ==
+           "[+s:atom \"multi\nline\":str \"!\":str] multi\nline!");
+    assert(results[2] == "[const:atom 1:int 2:int] 1");
+    assert(results[3] == "[+:atom 1:int [+:atom 2:int 3:int]] 6");
+
+    // Forms before an error still run.
+    std::istringstream broken("(+ 1 2) (+ 1");
+    count = 0;
+    try {
+        loader.Run(broken, [&](const Val&, Polymorphic&) { ++count; });
+        assert(false);
+    } catch (const std::runtime_error& e) {
+        assert(std::string(e.what()) == "parse error at byte 8");
+    }
+    assert(count == 1);
+
+    // A string cut by a read right before a paren isn't mistaken for an atom.
+    Loader::Options sevens = opts;
+    sevens.chunk_size = 7;
+    std::istringstream quoted("(+s \"a)\" \"b\")");
+    Loader(ctx, sevens).Run(quoted, [&](const Val&, Polymorphic& res) {
+        assert(res.as<std::string>() == "a)b");
+    });
+
+    // Forms of a live stream run as soon as they are complete, without
+    // waiting for a whole chunk nor for the next form.
+    for (size_t chunk_size : {size_t(8), size_t(64 << 10)}) {
+        Loader::Options live = opts;
+        live.chunk_size = chunk_size;
+        PipeBuf pipe;
+        std::istream piped(&pipe);
+        std::mutex mutex;
+        std::condition_variable ran;
+        std::vector<int> results;
+        bool late = false;
+        std::thread writer([&] {
+            for (size_t i = 1; i <= 3; ++i) {
+                pipe.Write("(+ " + std::to_string(i) + " 2)\n");
+                std::unique_lock<std::mutex> lock(mutex);
+                if (!ran.wait_for(lock, std::chrono::seconds(10), [&] {
+                        return results.size() == i;
+                    })) {
+                    late = true;
+                    break;
+                }
+            }
+            pipe.Close();
+        });
+        Loader(ctx, live).Run(piped, [&](const Val&, Polymorphic& res) {
+            std::lock_guard<std::mutex> lock(mutex);
+            results.push_back(res.as<int>());
+            ran.notify_all();
+        });
+        writer.join();
+        assert(!late);
+        assert((results == std::vector<int>{3, 4, 5}));
+    }
+
+    opts.max_form_size = 16;
+    Loader small(ctx, opts);
+    std::istringstream big("(+ 1 2) (+s \"" + std::string(100, 'x') + "\")");
+    try {
+        small.Run(big, [](const Val&, Polymorphic&) {});
+        assert(false);
+    } catch (const std::runtime_error& e) {
+        assert(std::string(e.what()) ==
+               "form at byte 8 is longer than 16 bytes");
+    }
+    // Invalid forms, such as ones broken over several lines, fail before
+    // what follows them is read.
+    std::string tail(100, ' ');
+    for (std::string in : {"(+ 1\n2)", "x (+ 1 2)", ")"}) {
+        std::istringstream invalid("(+ 1 2) " + in + tail);
+        count = 0;
+        try {
+            small.Run(invalid, [&](const Val&, Polymorphic&) { ++count; });
+            assert(false);
+        } catch (const std::runtime_error& e) {
+            assert(std::string(e.what()) == "parse error at byte 8");
+        }
+        assert(count == 1);
+    }
+
+    // A type error stops the reader, even if it is blocked on a full queue.
+    std::string many;
+    for (int i = 0; i < 1000; ++i) {
+        many += "(+ 1 \"x\")\n";
+    }
+    std::istringstream bad(many);
+    try {
+        loader.Run(bad, [](const Val&, Polymorphic&) {});
+        assert(false);
+    } catch (const std::runtime_error&) {
+    }
+}
+
+void test_wire() {
+    using namespace slip;
+    Context ctx;
+    ctx.ImportBase();
+    const std::vector<std::string> inputs = {
+        "(+ 1 2)",
+        "((if (< 1 2) (+) (*)) 2 3)",
+        "(+s \"Werez my \" \"SLIP?\")",
+        "(f () (g true false) \"\" 123456789 (f f f))",
+    };
+    for (auto& in : inputs) {
+        auto parsed = ParseRD(in);
+        std::string bytes = Serialize(parsed->first);
+        auto val = Deserialize(bytes);
+        assert(val && Print(*val) == Print(parsed->first));
+        auto flat = DeserializeFlat(bytes);
+        assert(flat && Print(flat->root()) == Print(parsed->first));
+        // Every truncation is rejected, and so are trailing bytes.
+        for (size_t i = 0; i < bytes.size(); ++i) {
+            assert(!Deserialize(boost::string_view(bytes.data(), i)));
+        }
+        assert(!Deserialize(bytes + '\0'));
+    }
+
+    // Atoms are written once.
+    std::string bytes = Serialize(ParseRD("(+ (+ 1 2) (+ 3 4))")->first);
+    assert(std::count(bytes.begin(), bytes.end(), '+') == 1);
+
+    // What the text grammar can't express round trips too.
+    Val odd = List({Int(-7),
+                    Str(std::string("quote \" and\nnewline")),
+                    Int(std::numeric_limits<int>::min())});
+    assert(Print(*Deserialize(Serialize(odd))) == Print(odd));
+    assert(Print(*Deserialize(Serialize(Int(42)))) == "42:int");
+
+    // Varints of more than 32 bits are rejected rather than truncated.
+    const std::string int_head = {static_cast<char>(wire::kVersion),
+                                  '\0',
+                                  static_cast<char>(wire::Tag::Int)};
+    auto widest = Deserialize(int_head + "\xFF\xFF\xFF\xFF\x0F");
+    assert(widest &&
+           Print(*widest) == Print(Int(std::numeric_limits<int>::min())));
+    assert(!Deserialize(int_head + "\xFF\xFF\xFF\xFF\x1F"));
+    assert(!Deserialize(int_head + "\x80\x80\x80\x80\x10"));
+
+    auto buffer = std::make_shared<const std::string>(
+        Serialize(ParseRD("(+s \"no \" \"copy\")")->first));
+    auto script = DeserializeScript(buffer);
+    const Str& literal = boost::get<Str>(boost::get<List>(script->root())[1]);
+    assert(literal.borrowed());
+    assert(literal.view().data() >= buffer->data() &&
+           literal.view().data() < buffer->data() + buffer->size());
+    TypeCheck(script->root(), ctx);
+    assert(Eval<std::string>(script->root(), ctx) == "no copy");
+}
+
+void test_apply_cache() {
+    using namespace slip;
+    Context ctx;
+    ctx.ImportBase();
+    ApplyCache& cache = ApplyCache::Global();
+    size_t capacity = cache.capacity();
+    cache.Clear();
+
+    // Ground applications don't go through the cache.
+    CheckType("(+ 1 2)", "Int", ctx);
+    assert(cache.hits() == 0 && cache.misses() == 0);
+
+    CheckType("(if true 1 2)", "Int", ctx);
+    size_t misses = cache.misses();
+    assert(misses > 0);
+    CheckType("(if true 1 2)", "Int", ctx);
+    assert(cache.misses() == misses && cache.hits() > 0);
+    // Applications are keyed on instantiated types: renaming the
+    // variables of a type doesn't matter.
+    Prototype id_a(Arrow(TypeVar(0), TypeVar(0)));
+    Prototype id_z(Arrow(TypeVar(25), TypeVar(25)));
+    assert(id_a.Apply(Prototype(ConstType("Int"))).Show() == "Int");
+    size_t hits = cache.hits();
+    assert(id_z.Apply(Prototype(ConstType("Int"))).Show() == "Int");
+    assert(cache.hits() == hits + 1);
+
+    cache.set_capacity(32);
+    for (int i = 0; i < 100; ++i) {
+        id_a.Apply(Prototype(ConstType("T" + std::to_string(i))));
+    }
+    assert(cache.size() <= 32);
+    assert(id_a.Apply(Prototype(ConstType("T99"))).Show() == "T99");
+
+    // Threads typechecking at once share it.
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&ctx, t] {
+            for (int i = 0; i < 200; ++i) {
+                auto res = ParseRD("(const (if (== " + std::to_string(i % 7) +
+                                   " 1) \"a\" \"b\") " + std::to_string(t) +
+                                   ")");
+                assert(TypeExpression(res->first, ctx).Show() == "String");
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    assert(cache.size() <= 32);
+    cache.set_capacity(capacity);
 }
 
 int main() {
+    test_polymorphic_values();
+    test_closures();
+    test_link();
+    test_bytecode();
+    test_const_eval();
+    test_overloads();
+    test_prepared();
+    test_type_cache();
+    test_typed_ast();
+    test_apply_cache();
+    test_wire();
+    test_loader();
+    test_buffers();
+    test_parsers();
+    test_borrowed_strings();
+    test_symbols();
     test_concrete_functions();
     test_polymorphic_functions();
     test_prototype();